@@ -0,0 +1,324 @@
+#include <sqlitelib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace sqlitelib;
+
+// Microbenchmarks of the wrapper against hand-written raw C API code doing
+// the same work. Every case runs in batches that grow until a batch takes
+// at least MinBatchTime; the median of Samples batches is reported.
+//
+//   bench-main [--json] [filter]
+//
+// --json prints one object per case for tracking regressions across
+// releases; `filter` runs only the cases whose name contains it.
+
+namespace {
+
+const int Samples = 7;
+const auto MinBatchTime = chrono::milliseconds(10);
+
+// Benchmark functions return a checksum that is folded into this sink so
+// that the compiler cannot drop the work.
+volatile size_t sink;
+
+struct Measurement {
+  string group;
+  string impl;
+  double ns_per_op;
+  size_t iterations;
+};
+
+double run_batch(const function<size_t()>& fn, size_t iterations) {
+  auto start = chrono::steady_clock::now();
+  size_t sum = 0;
+  for (size_t i = 0; i < iterations; i++) {
+    sum += fn();
+  }
+  auto elapsed = chrono::steady_clock::now() - start;
+  sink = sink + sum;
+  return chrono::duration<double, nano>(elapsed).count();
+}
+
+Measurement measure(const string& group, const string& impl,
+                    const function<size_t()>& fn) {
+  size_t iterations = 1;
+  while (run_batch(fn, iterations) <
+         chrono::duration<double, nano>(MinBatchTime).count()) {
+    iterations *= 2;
+  }
+
+  vector<double> samples;
+  for (auto i = 0; i < Samples; i++) {
+    samples.push_back(run_batch(fn, iterations) / iterations);
+  }
+  sort(samples.begin(), samples.end());
+  return Measurement{group, impl, samples[Samples / 2], iterations};
+}
+
+class Suite {
+ public:
+  Suite(bool json, const char* filter) : json_(json), filter_(filter) {}
+
+  void compare(const string& group, const function<size_t()>& raw,
+               const function<size_t()>& lib) {
+    if (filter_ && group.find(filter_) == string::npos) {
+      return;
+    }
+    auto r = measure(group, "raw", raw);
+    auto l = measure(group, "sqlitelib", lib);
+    if (!json_) {
+      printf("%-32s %12.1f %12.1f %8.2fx\n", group.c_str(), r.ns_per_op,
+             l.ns_per_op, l.ns_per_op / r.ns_per_op);
+    }
+    results_.push_back(r);
+    results_.push_back(l);
+  }
+
+  void header() const {
+    if (!json_) {
+      printf("%-32s %12s %12s %9s\n", "benchmark (ns/op)", "raw C API",
+             "sqlitelib", "ratio");
+    }
+  }
+
+  void report() const {
+    if (!json_) {
+      return;
+    }
+    printf("{\n  \"sqlite_version\": \"%s\",\n  \"benchmarks\": [",
+           sqlite3_libversion());
+    for (size_t i = 0; i < results_.size(); i++) {
+      const auto& r = results_[i];
+      printf("%s\n    {\"name\": \"%s\", \"impl\": \"%s\", "
+             "\"ns_per_op\": %.2f, \"iterations\": %zu}",
+             i ? "," : "", r.group.c_str(), r.impl.c_str(), r.ns_per_op,
+             r.iterations);
+    }
+    printf("\n  ]\n}\n");
+  }
+
+ private:
+  bool json_;
+  const char* filter_;
+  vector<Measurement> results_;
+};
+
+sqlite3_stmt* raw_prepare(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", sql, sqlite3_errmsg(db));
+    exit(1);
+  }
+  return stmt;
+}
+
+// Both sides get their own in-memory copy of the same 1000 rows so that file
+// locking does not dominate the per-statement cases.
+const char* Schema =
+    "CREATE TABLE items (id INTEGER PRIMARY KEY, num INTEGER, name TEXT, "
+    "score REAL, data BLOB)";
+
+const char* Populate =
+    "INSERT INTO items (num, name, score, data) "
+    "WITH RECURSIVE seq(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM seq "
+    "WHERE i < 999) SELECT i, 'name' || i, i * 0.5, zeroblob(64) FROM seq";
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  auto json = false;
+  const char* filter = nullptr;
+  for (auto i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--json")) {
+      json = true;
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  Sqlite db(":memory:");
+  db.execute(Schema);
+  db.execute(Populate);
+
+  sqlite3* raw = nullptr;
+  sqlite3_open(":memory:", &raw);
+  sqlite3_exec(raw, Schema, nullptr, nullptr, nullptr);
+  sqlite3_exec(raw, Populate, nullptr, nullptr, nullptr);
+
+  Suite suite(json, filter);
+  suite.header();
+
+  const char* lookup_sql = "SELECT num, name FROM items WHERE id=?";
+
+  suite.compare(
+      "prepare",
+      [&] {
+        auto stmt = raw_prepare(raw, lookup_sql);
+        sqlite3_finalize(stmt);
+        return size_t(1);
+      },
+      [&] {
+        auto stmt = db.prepare<int, string>(lookup_sql);
+        return size_t(1);
+      });
+
+  // Binding
+  auto raw_bind = raw_prepare(raw, "SELECT ?");
+  auto lib_bind = db.prepare<int>("SELECT ?");
+  string text(32, 'x');
+  vector<char> blob(256, 'x');
+
+  suite.compare(
+      "bind int",
+      [&] {
+        sqlite3_reset(raw_bind);
+        return size_t(sqlite3_bind_int(raw_bind, 1, 42));
+      },
+      [&] {
+        lib_bind.bind(42);
+        return size_t(0);
+      });
+
+  suite.compare(
+      "bind text",
+      [&] {
+        sqlite3_reset(raw_bind);
+        return size_t(sqlite3_bind_text(raw_bind, 1, text.data(),
+                                        static_cast<int>(text.size()),
+                                        SQLITE_TRANSIENT));
+      },
+      [&] {
+        lib_bind.bind(text);
+        return size_t(0);
+      });
+
+  suite.compare(
+      "bind blob",
+      [&] {
+        sqlite3_reset(raw_bind);
+        return size_t(sqlite3_bind_blob(raw_bind, 1, blob.data(),
+                                        static_cast<int>(blob.size()),
+                                        SQLITE_TRANSIENT));
+      },
+      [&] {
+        lib_bind.bind(blob);
+        return size_t(0);
+      });
+
+  sqlite3_finalize(raw_bind);
+
+  // Stepping: bind, step and reset a point lookup
+  auto raw_lookup = raw_prepare(raw, "SELECT num FROM items WHERE id=?");
+  auto lib_lookup = db.prepare<int>("SELECT num FROM items WHERE id=?");
+
+  auto raw_step = [&] {
+    sqlite3_bind_int(raw_lookup, 1, 500);
+    sqlite3_step(raw_lookup);
+    auto value = sqlite3_column_int(raw_lookup, 0);
+    sqlite3_reset(raw_lookup);
+    return size_t(value);
+  };
+
+  suite.compare(
+      "step (execute_value)", raw_step,
+      [&] { return size_t(lib_lookup.execute_value(500)); });
+
+  suite.compare("step (flat execute_value)", raw_step, [&] {
+    auto sql = "SELECT num FROM items WHERE id=?";
+    return size_t(db.execute_value<int>(sql, 500));
+  });
+
+  sqlite3_finalize(raw_lookup);
+
+  // Decoding the columns of a row the statement is positioned on
+  auto row =
+      raw_prepare(raw, "SELECT num, name, score FROM items WHERE id=2");
+  sqlite3_step(row);
+
+  suite.compare(
+      "get_column_value<int>",
+      [&] { return size_t(sqlite3_column_int(row, 0)); },
+      [&] { return size_t(get_column_value<int>(row, 0)); });
+
+  suite.compare(
+      "get_column_value<string>",
+      [&] {
+        auto p = reinterpret_cast<const char*>(sqlite3_column_text(row, 1));
+        return string(p, sqlite3_column_bytes(row, 1)).size();
+      },
+      [&] { return get_column_value<string>(row, 1).size(); });
+
+  suite.compare(
+      "ColumnValues<int, string, double>",
+      [&] {
+        auto p = reinterpret_cast<const char*>(sqlite3_column_text(row, 1));
+        auto values = make_tuple(sqlite3_column_int(row, 0),
+                                 string(p, sqlite3_column_bytes(row, 1)),
+                                 sqlite3_column_double(row, 2));
+        return get<1>(values).size();
+      },
+      [&] {
+        auto values = ColumnValues<3, int, string, double>::get(row, 0);
+        return get<1>(values).size();
+      });
+
+  sqlite3_finalize(row);
+
+  // Whole results
+  const char* scan_sql = "SELECT num, name FROM items";
+  auto raw_scan = raw_prepare(raw, scan_sql);
+  auto lib_scan = db.prepare<int, string>(scan_sql);
+
+  suite.compare(
+      "execute (1000 rows)",
+      [&] {
+        vector<tuple<int, string>> rows;
+        while (sqlite3_step(raw_scan) == SQLITE_ROW) {
+          auto p =
+              reinterpret_cast<const char*>(sqlite3_column_text(raw_scan, 1));
+          rows.emplace_back(sqlite3_column_int(raw_scan, 0),
+                            string(p, sqlite3_column_bytes(raw_scan, 1)));
+        }
+        sqlite3_reset(raw_scan);
+        return rows.size();
+      },
+      [&] { return lib_scan.execute().size(); });
+
+  auto raw_nums = raw_prepare(raw, "SELECT num FROM items");
+  auto lib_nums = db.prepare<int>("SELECT num FROM items");
+
+  suite.compare(
+      "cursor (1000 rows)",
+      [&] {
+        size_t sum = 0;
+        while (sqlite3_step(raw_nums) == SQLITE_ROW) {
+          sum += sqlite3_column_int(raw_nums, 0);
+        }
+        sqlite3_reset(raw_nums);
+        return sum;
+      },
+      [&] {
+        size_t sum = 0;
+        for (const auto& num : lib_nums.execute_cursor()) {
+          sum += num;
+        }
+        return sum;
+      });
+
+  sqlite3_finalize(raw_scan);
+  sqlite3_finalize(raw_nums);
+  sqlite3_close(raw);
+
+  suite.report();
+  return 0;
+}
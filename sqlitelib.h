@@ -10,327 +10,4391 @@
 
 #include <sqlite3.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if __cplusplus >= 202002L
+#include <coroutine>
+#include <span>
+#endif
+
+// Without exception support errors that would throw abort instead; the try_
+// functions report expected failures as values.
+#if !defined(SQLITELIB_NO_EXCEPTIONS) && !defined(__cpp_exceptions) && \
+    !defined(__EXCEPTIONS) && !defined(_CPPUNWIND)
+#define SQLITELIB_NO_EXCEPTIONS
+#endif
+
+#ifdef SQLITELIB_NO_EXCEPTIONS
+#define SQLITELIB_TRY if (true)
+#define SQLITELIB_CATCH_ALL else
+#define SQLITELIB_THROW(e) std::abort()
+#define SQLITELIB_RETHROW std::abort()
+#else
+#define SQLITELIB_TRY try
+#define SQLITELIB_CATCH_ALL catch (...)
+#define SQLITELIB_THROW(e) throw e
+#define SQLITELIB_RETHROW throw
+#endif
+
 namespace sqlitelib {
 
+struct Error {
+  int code = SQLITE_OK;  // primary result code
+  int extended_code = SQLITE_OK;
+  std::string errmsg;  // sqlite3_errmsg() of the connection, if known
+
+  const char* message() const {
+    return errmsg.empty() ? sqlite3_errstr(extended_code) : errmsg.c_str();
+  }
+};
+
+class Exception : public std::runtime_error {
+ public:
+  explicit Exception(const Error& error)
+      : std::runtime_error(error.message()), error_(error) {}
+
+  int code() const { return error_.code; }
+  int extended_code() const { return error_.extended_code; }
+  const Error& error() const { return error_; }
+
+ private:
+  Error error_;
+};
+
 namespace {
 
 void* enabler;
 
+// The connection's error is used only while it still describes `rc`; a later
+// call, such as the next bind, may already have cleared it.
+inline Error make_error(sqlite3* db, int rc) {
+  auto extended = db ? sqlite3_extended_errcode(db) : rc;
+  if (!db || (extended & 0xff) != (rc & 0xff)) {
+    return Error{rc & 0xff, rc, std::string()};
+  }
+  return Error{rc & 0xff, extended, sqlite3_errmsg(db)};
+}
+
+inline Error make_error(sqlite3_stmt* stmt, int rc) {
+  return make_error(sqlite3_db_handle(stmt), rc);
+}
+
 inline void verify(int rc, int expected = SQLITE_OK) {
   if (rc != expected) {
-    throw std::exception();
+    SQLITELIB_THROW(Exception(Error{rc & 0xff, rc, std::string()}));
   }
 }
 
-template <typename T>
-T get_column_value(sqlite3_stmt* stmt, int col) {}
+inline void verify(sqlite3* db, int rc, int expected = SQLITE_OK) {
+  if (rc != expected) {
+    SQLITELIB_THROW(Exception(make_error(db, rc)));
+  }
+}
 
-template <>
-int get_column_value<int>(sqlite3_stmt* stmt, int col) {
-  return sqlite3_column_int(stmt, col);
+inline void verify(sqlite3_stmt* stmt, int rc, int expected = SQLITE_OK) {
+  verify(sqlite3_db_handle(stmt), rc, expected);
 }
 
+};  // namespace
+
+// Value or Error, after std::expected
+template <typename T>
+class Result {
+ public:
+  Result(T value) : value_(std::move(value)) {}
+  Result(const Error& error) : error_(error) {}
+
+  bool has_value() const { return value_.has_value(); }
+  explicit operator bool() const { return has_value(); }
+
+  T& value() & {
+    check();
+    return *value_;
+  }
+  const T& value() const& {
+    check();
+    return *value_;
+  }
+  T&& value() && {
+    check();
+    return std::move(*value_);
+  }
+
+  T& operator*() { return *value_; }
+  const T& operator*() const { return *value_; }
+  T* operator->() { return &*value_; }
+  const T* operator->() const { return &*value_; }
+
+  const Error& error() const { return error_; }
+
+ private:
+  void check() const {
+    if (!value_) {
+      SQLITELIB_THROW(Exception(error_));
+    }
+  }
+
+  std::optional<T> value_;
+  Error error_;
+};
+
 template <>
-double get_column_value<double>(sqlite3_stmt* stmt, int col) {
-  return sqlite3_column_double(stmt, col);
-}
+class Result<void> {
+ public:
+  Result() : ok_(true) {}
+  Result(const Error& error) : ok_(false), error_(error) {}
+
+  bool has_value() const { return ok_; }
+  explicit operator bool() const { return ok_; }
+
+  void value() const {
+    if (!ok_) {
+      SQLITELIB_THROW(Exception(error_));
+    }
+  }
+
+  const Error& error() const { return error_; }
+
+ private:
+  bool ok_;
+  Error error_;
+};
+
+// Customization point for column and parameter types. Specialize it for a
+// type to use it in results and as an argument:
+//
+//   template <>
+//   struct type_traits<Uuid> {
+//     static int bind(sqlite3_stmt* stmt, int col, const Uuid& val,
+//                     sqlite3_destructor_type lifetime) {
+//       return sqlite3_bind_blob(stmt, col, val.bytes, 16, lifetime);
+//     }
+//     static Uuid fetch(sqlite3_stmt* stmt, int col) { ... }
+//   };
+//
+// `bind` returns an SQLite result code. `lifetime` is SQLITE_STATIC when the
+// argument outlives the step, and SQLITE_TRANSIENT otherwise.
+template <typename T, typename Enable = void>
+struct type_traits {};
 
 template <>
-std::string get_column_value<std::string>(sqlite3_stmt* stmt, int col) {
-  auto val = std::string(sqlite3_column_bytes(stmt, col), 0);
-  memcpy(&val[0], sqlite3_column_text(stmt, col), val.size());
-  return val;
-}
+struct type_traits<std::nullptr_t> {
+  static int bind(sqlite3_stmt* stmt, int col, const std::nullptr_t&,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_null(stmt, col);
+  }
+};
 
 template <>
-std::vector<char> get_column_value<std::vector<char>>(sqlite3_stmt* stmt,
-                                                      int col) {
-  auto val = std::vector<char>(sqlite3_column_bytes(stmt, col));
-  memcpy(&val[0], sqlite3_column_blob(stmt, col), val.size());
-  return val;
-}
+struct type_traits<std::nullopt_t> {
+  static int bind(sqlite3_stmt* stmt, int col, const std::nullopt_t&,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_null(stmt, col);
+  }
+};
 
-template <int N, typename T, typename... Rest>
-struct ColumnValues;
+// std::optional maps an empty value to NULL and back.
+template <typename T>
+struct type_traits<std::optional<T>> {
+  static int bind(sqlite3_stmt* stmt, int col, const std::optional<T>& val,
+                  sqlite3_destructor_type lifetime) {
+    if (!val) {
+      return sqlite3_bind_null(stmt, col);
+    }
+    return type_traits<T>::bind(stmt, col, *val, lifetime);
+  }
 
-template <int N, typename T, typename... Rest>
-struct ColumnValues {
-  static std::tuple<T, Rest...> get(sqlite3_stmt* stmt, int col) {
-    return std::tuple_cat(std::make_tuple(get_column_value<T>(stmt, col)),
-                          ColumnValues<N - 1, Rest...>::get(stmt, col + 1));
+  static std::optional<T> fetch(sqlite3_stmt* stmt, int col) {
+    if (sqlite3_column_type(stmt, col) == SQLITE_NULL) {
+      return std::nullopt;
+    }
+    return type_traits<T>::fetch(stmt, col);
+  }
+};
+
+template <>
+struct type_traits<int> {
+  static int bind(sqlite3_stmt* stmt, int col, const int& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_int(stmt, col, val);
+  }
+
+  static int fetch(sqlite3_stmt* stmt, int col) {
+    return sqlite3_column_int(stmt, col);
   }
 };
 
+// Other integer types are stored as 64-bit integers. Unsigned 64-bit values
+// above INT64_MAX wrap around.
 template <typename T>
-struct ColumnValues<1, T> {
-  static std::tuple<T> get(sqlite3_stmt* stmt, int col) {
-    return std::make_tuple(get_column_value<T>(stmt, col));
+struct type_traits<
+    T, typename std::enable_if<std::is_integral<T>::value &&
+                               !std::is_same<T, bool>::value>::type> {
+  static int bind(sqlite3_stmt* stmt, int col, const T& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_int64(stmt, col, static_cast<sqlite3_int64>(val));
+  }
+
+  static T fetch(sqlite3_stmt* stmt, int col) {
+    return static_cast<T>(sqlite3_column_int64(stmt, col));
   }
 };
 
-template <typename Arg>
-void bind_value(sqlite3_stmt* stmt, int col, Arg val) {}
+template <>
+struct type_traits<bool> {
+  static int bind(sqlite3_stmt* stmt, int col, const bool& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_int(stmt, col, val ? 1 : 0);
+  }
+
+  static bool fetch(sqlite3_stmt* stmt, int col) {
+    return sqlite3_column_int(stmt, col) != 0;
+  }
+};
 
 template <>
-void bind_value<int>(sqlite3_stmt* stmt, int col, int val) {
-  verify(sqlite3_bind_int(stmt, col, val));
-}
+struct type_traits<double> {
+  static int bind(sqlite3_stmt* stmt, int col, const double& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_double(stmt, col, val);
+  }
+
+  static double fetch(sqlite3_stmt* stmt, int col) {
+    return sqlite3_column_double(stmt, col);
+  }
+};
 
 template <>
-void bind_value<double>(sqlite3_stmt* stmt, int col, double val) {
-  verify(sqlite3_bind_double(stmt, col, val));
-}
+struct type_traits<float> {
+  static int bind(sqlite3_stmt* stmt, int col, const float& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_double(stmt, col, val);
+  }
+
+  static float fetch(sqlite3_stmt* stmt, int col) {
+    return static_cast<float>(sqlite3_column_double(stmt, col));
+  }
+};
 
 template <>
-void bind_value<std::string>(sqlite3_stmt* stmt, int col, std::string val) {
-  verify(sqlite3_bind_text(stmt, col, val.data(), static_cast<int>(val.size()),
-                           SQLITE_TRANSIENT));
-}
+struct type_traits<std::string> {
+  static int bind(sqlite3_stmt* stmt, int col, const std::string& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_text(stmt, col, val.data(),
+                             static_cast<int>(val.size()), lifetime);
+  }
+
+  static std::string fetch(sqlite3_stmt* stmt, int col) {
+    auto p = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+    return p ? std::string(p, sqlite3_column_bytes(stmt, col)) : std::string();
+  }
+};
 
 template <>
-void bind_value<const char*>(sqlite3_stmt* stmt, int col, const char* val) {
-  verify(sqlite3_bind_text(stmt, col, val, static_cast<int>(strlen(val)),
-                           SQLITE_TRANSIENT));
-}
+struct type_traits<const char*> {
+  static int bind(sqlite3_stmt* stmt, int col, const char* const& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_text(stmt, col, val, static_cast<int>(strlen(val)),
+                             lifetime);
+  }
+};
+
+template <>
+struct type_traits<std::vector<char>> {
+  static int bind(sqlite3_stmt* stmt, int col, const std::vector<char>& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_blob(stmt, col, val.data(),
+                             static_cast<int>(val.size()), lifetime);
+  }
 
+  static std::vector<char> fetch(sqlite3_stmt* stmt, int col) {
+    auto p = static_cast<const char*>(sqlite3_column_blob(stmt, col));
+    return p ? std::vector<char>(p, p + sqlite3_column_bytes(stmt, col))
+             : std::vector<char>();
+  }
+};
+
+// Views into SQLite's column buffers; valid until the next step or reset.
+template <>
+struct type_traits<std::string_view> {
+  static int bind(sqlite3_stmt* stmt, int col, const std::string_view& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_text(stmt, col, val.data(),
+                             static_cast<int>(val.size()), lifetime);
+  }
+
+  static std::string_view fetch(sqlite3_stmt* stmt, int col) {
+    auto p = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+    return std::string_view(p, sqlite3_column_bytes(stmt, col));
+  }
+};
+
+#if __cplusplus >= 202002L
 template <>
-void bind_value<std::vector<char>>(sqlite3_stmt* stmt, int col,
-                                   std::vector<char> val) {
-  verify(sqlite3_bind_blob(stmt, col, val.data(), static_cast<int>(val.size()),
-                           SQLITE_TRANSIENT));
+struct type_traits<std::span<const std::byte>> {
+  static int bind(sqlite3_stmt* stmt, int col,
+                  const std::span<const std::byte>& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_blob(stmt, col, val.data(),
+                             static_cast<int>(val.size()), lifetime);
+  }
+
+  static std::span<const std::byte> fetch(sqlite3_stmt* stmt, int col) {
+    auto p = static_cast<const std::byte*>(sqlite3_column_blob(stmt, col));
+    return std::span<const std::byte>(p, sqlite3_column_bytes(stmt, col));
+  }
+};
+#endif
+
+namespace {
+
+template <typename T, typename = void>
+struct HasTypeTraits : std::false_type {};
+
+template <typename T>
+struct HasTypeTraits<T, decltype(void(&type_traits<T>::bind))>
+    : std::true_type {};
+
+template <typename T>
+T get_column_value(sqlite3_stmt* stmt, int col) {
+  return type_traits<T>::fetch(stmt, col);
 }
 
-template <bool isRestEmpty, typename T, typename... Rest>
-struct ValueType;
+template <typename T>
+struct IsBorrowed : std::false_type {};
+
+template <>
+struct IsBorrowed<std::string_view> : std::true_type {};
+
+#if __cplusplus >= 202002L
+template <>
+struct IsBorrowed<std::span<const std::byte>> : std::true_type {};
+#endif
+
+template <typename... Types>
+struct AnyBorrowed : std::false_type {};
 
 template <typename T, typename... Rest>
-struct ValueType<true, T, Rest...> {
-  typedef T type;
+struct AnyBorrowed<T, Rest...>
+    : std::integral_constant<bool, IsBorrowed<T>::value ||
+                                       AnyBorrowed<Rest...>::value> {};
+
+template <int N, typename T, typename... Rest>
+struct ColumnValues;
+
+template <int N, typename T, typename... Rest>
+struct ColumnValues {
+  static std::tuple<T, Rest...> get(sqlite3_stmt* stmt, int col) {
+    return std::tuple_cat(std::make_tuple(get_column_value<T>(stmt, col)),
+                          ColumnValues<N - 1, Rest...>::get(stmt, col + 1));
+  }
 };
 
-template <typename T, typename... Rest>
-struct ValueType<false, T, Rest...> {
-  typedef std::tuple<T, Rest...> type;
+template <typename T>
+struct ColumnValues<1, T> {
+  static std::tuple<T> get(sqlite3_stmt* stmt, int col) {
+    return std::make_tuple(get_column_value<T>(stmt, col));
+  }
 };
 
 };  // namespace
 
-template <typename T, typename... Rest>
-class Iterator {
+// Validity bitmap shared by all column types: bit i (LSB first) is set when
+// row i is not NULL.
+class ColumnValidity {
  public:
-  typedef std::forward_iterator_tag iterator_category;
-  typedef typename ValueType<!sizeof...(Rest), T, Rest...>::type value_type;
-  typedef std::ptrdiff_t difference_type;
-  typedef value_type* pointer;
-  typedef value_type& reference;
-
-  Iterator() : stmt_(nullptr), id_(-1) {}
+  size_t size() const { return size_; }
 
-  Iterator(sqlite3_stmt* stmt) : stmt_(stmt), id_(-1) { operator++(); }
+  size_t null_count() const { return null_count_; }
 
-  template <int RestSize = sizeof...(Rest),
-            typename std::enable_if<(RestSize == 0)>::type*& = enabler>
-  value_type operator*() const {
-    return get_column_value<T>(stmt_, 0);
+  bool is_null(size_t i) const {
+    return !(validity_[i / 8] & (1 << (i % 8)));
   }
 
-  template <int RestSize = sizeof...(Rest),
-            typename std::enable_if<(RestSize != 0)>::type*& = enabler>
-  value_type operator*() const {
-    return ColumnValues<1 + sizeof...(Rest), T, Rest...>::get(stmt_, 0);
-  }
+  const std::vector<uint8_t>& validity() const { return validity_; }
 
-  Iterator& operator++() {
-    if (stmt_) {
-      auto rc = sqlite3_step(stmt_);
-      if (rc == SQLITE_ROW) {
-        ++id_;
-      } else if (rc == SQLITE_DONE) {
-        id_ = -1;
-      } else {
-        throw std::exception();  // TODO:
-      }
+ protected:
+  void push_validity(bool valid) {
+    if (size_ % 8 == 0) {
+      validity_.push_back(0);
+    }
+    if (valid) {
+      validity_.back() |= static_cast<uint8_t>(1 << (size_ % 8));
     } else {
-      throw std::exception();  // TODO:
+      ++null_count_;
     }
-    return *this;
+    ++size_;
   }
 
-  bool operator==(const Iterator& rhs) { return id_ == rhs.id_; }
+  std::vector<uint8_t> validity_;
+  size_t size_ = 0;
+  size_t null_count_ = 0;
+};
 
-  bool operator!=(const Iterator& rhs) { return !operator==(rhs); }
+// One result column stored contiguously. NULLs hold a default value.
+template <typename T>
+class Column : public ColumnValidity {
+ public:
+  const T& operator[](size_t i) const { return values_[i]; }
 
- private:
-  sqlite3_stmt* stmt_;
-  int id_;
-};
+  const std::vector<T>& values() const { return values_; }
+
+  std::vector<T>& values() { return values_; }
+
+  void append(sqlite3_stmt* stmt, int col) {
+    auto valid = sqlite3_column_type(stmt, col) != SQLITE_NULL;
+    values_.push_back(valid ? get_column_value<T>(stmt, col) : T());
+    push_validity(valid);
+  }
 
-inline void sqlite3_stmt_deleter(sqlite3_stmt* stmt) {
-  verify(sqlite3_finalize(stmt));
+ private:
+  std::vector<T> values_;
 };
 
-template <typename T, typename... Rest>
-class Cursor {
+// Stores one byte per cell, since std::vector<bool> cannot hand out
+// references to its elements.
+template <>
+class Column<bool> : public ColumnValidity {
  public:
-  Cursor() = delete;
-  Cursor(const Cursor&) = delete;
-  Cursor& operator=(const Cursor&) = delete;
-
-  Cursor(Cursor&& rhs) : stmt_(rhs.stmt_) {}
+  bool operator[](size_t i) const { return values_[i] != 0; }
 
-  Cursor(std::shared_ptr<sqlite3_stmt> stmt) : stmt_(stmt) {}
+  const std::vector<uint8_t>& values() const { return values_; }
 
-  Iterator<T, Rest...> begin() { return Iterator<T, Rest...>(stmt_.get()); }
+  std::vector<uint8_t>& values() { return values_; }
 
-  Iterator<T, Rest...> end() { return Iterator<T, Rest...>(); }
+  void append(sqlite3_stmt* stmt, int col) {
+    auto valid = sqlite3_column_type(stmt, col) != SQLITE_NULL;
+    values_.push_back(valid && sqlite3_column_int(stmt, col) ? 1 : 0);
+    push_validity(valid);
+  }
 
  private:
-  std::shared_ptr<sqlite3_stmt> stmt_;
+  std::vector<uint8_t> values_;
 };
 
-template <typename T, typename... Rest>
-class Statement {
+// Variable-length columns keep all cells in one buffer; cell i spans
+// [offsets()[i], offsets()[i + 1]).
+class VariableColumn : public ColumnValidity {
  public:
-  Statement(sqlite3* db, const char* query)
-      : stmt_(new_sqlite3_stmt(db, query), sqlite3_stmt_deleter) {}
+  VariableColumn() : offsets_(1, 0) {}
 
-  Statement(Statement&& rhs) : stmt_(rhs.stmt_) { rhs.stmt_ = nullptr; }
+  const std::vector<int64_t>& offsets() const { return offsets_; }
 
-  Statement() = delete;
-  Statement(Statement& rhs) = default;
-  ~Statement() = default;
+  const std::vector<char>& data() const { return data_; }
 
-  template <typename... Args>
-  Statement<T, Rest...>& bind(const Args&... args) {
-    verify(sqlite3_reset(stmt_.get()));
-    bind_values(1, args...);
-    return *this;
-  }
+  std::vector<int64_t>& offsets() { return offsets_; }
 
-  template <
-      typename U = T,
-      typename std::enable_if<std::is_same<U, void>::value>::type*& = enabler,
-      typename... Args>
-  void execute(const Args&... args) {
-    bind(args...);
-    verify(sqlite3_step(stmt_.get()), SQLITE_DONE);
-  }
+  std::vector<char>& data() { return data_; }
 
-  template <
-      typename U = T,
-      typename std::enable_if<!std::is_same<U, void>::value>::type*& = enabler,
-      typename V = typename ValueType<!sizeof...(Rest), T, Rest...>::type,
-      typename... Args>
-  std::vector<V> execute(const Args&... args) {
-    std::vector<V> ret;
-    for (const auto& x : execute_cursor(args...)) {
-      ret.push_back(x);
+ protected:
+  void append_bytes(const void* p, int bytes) {
+    auto valid = p != nullptr;
+    if (bytes > 0) {
+      auto first = static_cast<const char*>(p);
+      data_.insert(data_.end(), first, first + bytes);
     }
-    return ret;
+    offsets_.push_back(static_cast<int64_t>(data_.size()));
+    push_validity(valid);
   }
 
-  template <typename... Args>
-  T execute_value(const Args&... args) {
-    auto cursor = execute_cursor(args...);
-    return *cursor.begin();
+  std::vector<int64_t> offsets_;
+  std::vector<char> data_;
+};
+
+template <>
+class Column<std::string> : public VariableColumn {
+ public:
+  std::string_view operator[](size_t i) const {
+    return std::string_view(data_.data() + offsets_[i],
+                            offsets_[i + 1] - offsets_[i]);
   }
 
-  template <typename... Args>
-  Cursor<T, Rest...> execute_cursor(const Args&... args) {
-    bind(args...);
-    return Cursor<T, Rest...>(stmt_);
+  void append(sqlite3_stmt* stmt, int col) {
+    auto p = sqlite3_column_text(stmt, col);
+    append_bytes(p, sqlite3_column_bytes(stmt, col));
   }
+};
 
- private:
-  Statement& operator=(const Statement& rhs);
+template <>
+class Column<std::vector<char>> : public VariableColumn {
+ public:
+  std::string_view operator[](size_t i) const {
+    return std::string_view(data_.data() + offsets_[i],
+                            offsets_[i + 1] - offsets_[i]);
+  }
 
-  sqlite3_stmt* new_sqlite3_stmt(sqlite3* db, const char* query) {
-    sqlite3_stmt* p = nullptr;
-    verify(sqlite3_prepare(db, query, static_cast<int>(strlen(query)), &p,
-                           nullptr));
-    return p;
+  void append(sqlite3_stmt* stmt, int col) {
+    auto p = sqlite3_column_blob(stmt, col);
+    auto bytes = sqlite3_column_bytes(stmt, col);
+    // A zero-length blob comes back as NULL pointer too
+    if (!p && sqlite3_column_type(stmt, col) != SQLITE_NULL) {
+      p = "";
+    }
+    append_bytes(p, bytes);
   }
+};
 
-  void bind_values(int col) {}
+namespace {
 
-  template <typename Arg, typename... ArgRest>
-  void bind_values(int col, const Arg& val, const ArgRest&... rest) {
-    bind_value(stmt_.get(), col, val);
-    bind_values(col + 1, rest...);
+template <typename Columns, size_t I = 0,
+          bool End = (I == std::tuple_size<Columns>::value)>
+struct ColumnAppender {
+  static void append(sqlite3_stmt* stmt, Columns& columns) {
+    std::get<I>(columns).append(stmt, static_cast<int>(I));
+    ColumnAppender<Columns, I + 1>::append(stmt, columns);
   }
+};
 
-  std::shared_ptr<sqlite3_stmt> stmt_;
+template <typename Columns, size_t I>
+struct ColumnAppender<Columns, I, true> {
+  static void append(sqlite3_stmt* stmt, Columns& columns) {}
 };
 
-class Sqlite {
- public:
-  Sqlite() = delete;
-  Sqlite(const Sqlite&) = delete;
-  Sqlite& operator=(const Sqlite&) = delete;
+template <bool isRestEmpty, typename T, typename... Rest>
+struct ColumnsType;
 
-  Sqlite(const char* path) : db_(nullptr) {
-    auto rc = sqlite3_open(path, &db_);
+template <typename T, typename... Rest>
+struct ColumnsType<true, T, Rest...> {
+  typedef Column<T> type;
+
+  static type get(std::tuple<Column<T>>&& columns) {
+    return std::move(std::get<0>(columns));
+  }
+};
+
+template <typename T, typename... Rest>
+struct ColumnsType<false, T, Rest...> {
+  typedef std::tuple<Column<T>, Column<Rest>...> type;
+
+  static type get(type&& columns) { return std::move(columns); }
+};
+
+template <typename T, typename = void>
+struct IsTupleLike : std::false_type {};
+
+template <typename T>
+struct IsTupleLike<T, decltype(void(std::tuple_size<T>::value))>
+    : std::true_type {};
+
+// Aggregates (plain structs) are mapped to consecutive columns field by
+// field. The field count is found by probing brace-initialization, and the
+// fields are reached through structured bindings (up to 16 fields).
+struct AnyField {
+  template <typename T>
+  operator T() const;
+};
+
+template <typename T, typename = void, typename... Fields>
+struct IsBraceConstructible : std::false_type {};
+
+template <typename T, typename... Fields>
+struct IsBraceConstructible<T, decltype(void(T{std::declval<Fields>()...})),
+                            Fields...> : std::true_type {};
+
+template <typename T, bool More, typename... Fields>
+struct FieldCountImpl
+    : std::integral_constant<size_t, sizeof...(Fields)> {};
+
+template <typename T, typename... Fields>
+struct FieldCountImpl<T, true, Fields...>
+    : FieldCountImpl<T,
+                     IsBraceConstructible<T, void, Fields..., AnyField,
+                                          AnyField>::value,
+                     Fields..., AnyField> {};
+
+template <typename T>
+struct FieldCount
+    : FieldCountImpl<T, IsBraceConstructible<T, void, AnyField>::value> {};
+
+template <typename T>
+struct IsAggregateRow
+    : std::integral_constant<bool, std::is_class<T>::value &&
+                                       std::is_aggregate<T>::value &&
+                                       !IsTupleLike<T>::value &&
+                                       !HasTypeTraits<T>::value> {};
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 1>) {
+  auto& [a] = row;
+  return std::tie(a);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 2>) {
+  auto& [a, b] = row;
+  return std::tie(a, b);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 3>) {
+  auto& [a, b, c] = row;
+  return std::tie(a, b, c);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 4>) {
+  auto& [a, b, c, d] = row;
+  return std::tie(a, b, c, d);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 5>) {
+  auto& [a, b, c, d, e] = row;
+  return std::tie(a, b, c, d, e);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 6>) {
+  auto& [a, b, c, d, e, f] = row;
+  return std::tie(a, b, c, d, e, f);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 7>) {
+  auto& [a, b, c, d, e, f, g] = row;
+  return std::tie(a, b, c, d, e, f, g);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 8>) {
+  auto& [a, b, c, d, e, f, g, h] = row;
+  return std::tie(a, b, c, d, e, f, g, h);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 9>) {
+  auto& [a, b, c, d, e, f, g, h, i] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 10>) {
+  auto& [a, b, c, d, e, f, g, h, i, j] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 11>) {
+  auto& [a, b, c, d, e, f, g, h, i, j, k] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j, k);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 12>) {
+  auto& [a, b, c, d, e, f, g, h, i, j, k, l] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j, k, l);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 13>) {
+  auto& [a, b, c, d, e, f, g, h, i, j, k, l, m] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j, k, l, m);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 14>) {
+  auto& [a, b, c, d, e, f, g, h, i, j, k, l, m, n] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j, k, l, m, n);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 15>) {
+  auto& [a, b, c, d, e, f, g, h, i, j, k, l, m, n, o] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o);
+}
+
+template <typename T>
+auto field_refs(T& row, std::integral_constant<size_t, 16>) {
+  auto& [a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p] = row;
+  return std::tie(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p);
+}
+
+template <typename T>
+auto field_refs(T& row) {
+  typedef FieldCount<typename std::remove_const<T>::type> Count;
+  static_assert(Count::value >= 1 && Count::value <= 16,
+                "aggregates with 1 to 16 fields are supported");
+  return field_refs(row, std::integral_constant<size_t, Count::value>());
+}
+
+template <typename Refs, size_t I = 0,
+          bool End = (I == std::tuple_size<Refs>::value)>
+struct FieldValues {
+  static void get(sqlite3_stmt* stmt, int col, Refs& refs) {
+    auto& field = std::get<I>(refs);
+    field = get_column_value<typename std::decay<decltype(field)>::type>(
+        stmt, col);
+    FieldValues<Refs, I + 1>::get(stmt, col + 1, refs);
+  }
+};
+
+template <typename Refs, size_t I>
+struct FieldValues<Refs, I, true> {
+  static void get(sqlite3_stmt* stmt, int col, Refs& refs) {}
+};
+
+// Decodes a single-type result: one column, or all fields of an aggregate.
+template <typename T, typename = void>
+struct RowValue {
+  static T get(sqlite3_stmt* stmt, int col) {
+    return get_column_value<T>(stmt, col);
+  }
+};
+
+template <typename T>
+struct RowValue<T, typename std::enable_if<IsAggregateRow<T>::value>::type> {
+  static T get(sqlite3_stmt* stmt, int col) {
+    T row{};
+    auto refs = field_refs(row);
+    FieldValues<decltype(refs)>::get(stmt, col, refs);
+    return row;
+  }
+};
+
+// Bind failures are collected in `rc`, which keeps the first one, so that
+// the try_ functions can return them.
+template <typename Arg>
+void bind_value(sqlite3_stmt* stmt, int col, const Arg& val,
+                sqlite3_destructor_type lifetime, int& rc) {
+  auto ret = type_traits<Arg>::bind(stmt, col, val, lifetime);
+  if (rc == SQLITE_OK) {
+    rc = ret;
+  }
+}
+
+// Large rvalue strings and blobs are moved into the statement instead of
+// being copied by SQLITE_TRANSIENT. Below the threshold a copy is cheaper.
+const size_t OwnedBufferThreshold = 1024;
+
+// Binds one argument at `col` and returns the next column. An aggregate
+// argument binds all of its fields.
+template <typename Arg,
+          typename std::enable_if<!IsAggregateRow<Arg>::value>::type*& =
+              enabler>
+int bind_arg(sqlite3_stmt* stmt, int col, const Arg& val,
+             sqlite3_destructor_type lifetime, int& rc) {
+  bind_value<typename std::decay<const Arg>::type>(stmt, col, val, lifetime,
+                                                   rc);
+  return col + 1;
+}
+
+template <typename Arg,
+          typename std::enable_if<IsAggregateRow<Arg>::value>::type*& =
+              enabler>
+int bind_arg(sqlite3_stmt* stmt, int col, const Arg& val,
+             sqlite3_destructor_type lifetime, int& rc) {
+  auto refs = field_refs(val);
+  std::apply(
+      [&](const auto&... fields) {
+        ((col = bind_arg(stmt, col, fields, lifetime, rc)), ...);
+      },
+      refs);
+  return col;
+}
+
+// Arguments whose buffers can be handed to SQLite with SQLITE_STATIC. Any
+// class type with a type_traits specialization, including user-defined ones,
+// may bind storage it owns.
+template <typename Arg, typename Enable = void>
+struct IsBorrowable
+    : std::integral_constant<bool, std::is_same<Arg, const char*>::value ||
+                                       (std::is_class<Arg>::value &&
+                                        HasTypeTraits<Arg>::value)> {};
+
+template <typename T>
+struct IsBorrowable<std::optional<T>> : IsBorrowable<T> {};
+
+template <typename... Args>
+struct AnyBorrowable : std::false_type {};
+
+template <typename Arg, typename... Rest>
+struct AnyBorrowable<Arg, Rest...>
+    : std::integral_constant<
+          bool, IsBorrowable<typename std::decay<const Arg>::type>::value ||
+                    AnyBorrowable<Rest...>::value> {};
+
+template <typename Refs>
+struct AnyFieldBorrowable;
+
+template <typename... Fields>
+struct AnyFieldBorrowable<std::tuple<Fields...>> : AnyBorrowable<Fields...> {};
+
+// An aggregate argument binds its fields.
+template <typename Arg>
+struct IsBorrowable<Arg,
+                    typename std::enable_if<IsAggregateRow<Arg>::value>::type>
+    : AnyFieldBorrowable<decltype(field_refs(std::declval<const Arg&>()))> {};
+
+// Clears bindings on scope exit so that no SQLITE_STATIC binding outlives
+// the arguments it points to.
+template <bool Enabled>
+struct BindingsClearer {
+  BindingsClearer(sqlite3_stmt* stmt) : stmt_(stmt) {}
+  ~BindingsClearer() {
+    if (Enabled) {
+      sqlite3_clear_bindings(stmt_);
+    }
+  }
+
+  sqlite3_stmt* stmt_;
+};
+
+// Binds the fields of a row (a tuple, an aggregate or a single value) from
+// `col` on with SQLITE_STATIC, and returns the next column.
+template <typename Row,
+          typename std::enable_if<IsTupleLike<Row>::value>::type*& = enabler>
+int bind_row(sqlite3_stmt* stmt, int col, const Row& row, int& rc) {
+  std::apply(
+      [&](const auto&... vals) {
+        ((col = bind_arg(stmt, col, vals, SQLITE_STATIC, rc)), ...);
+      },
+      row);
+  return col;
+}
+
+template <typename Row,
+          typename std::enable_if<!IsTupleLike<Row>::value>::type*& = enabler>
+int bind_row(sqlite3_stmt* stmt, int col, const Row& row, int& rc) {
+  return bind_arg(stmt, col, row, SQLITE_STATIC, rc);
+}
+
+// Number of columns bind_arg and bind_row bind for a type.
+template <typename Arg, typename Enable = void>
+struct ArgWidth : std::integral_constant<size_t, 1> {};
+
+template <typename Row,
+          typename = std::make_index_sequence<std::tuple_size<Row>::value>>
+struct FieldsWidth;
+
+template <typename Row, size_t... I>
+struct FieldsWidth<Row, std::index_sequence<I...>>
+    : std::integral_constant<
+          size_t, (0 + ... +
+                   ArgWidth<typename std::decay<
+                       typename std::tuple_element<I, Row>::type>::type>::
+                       value)> {};
+
+template <typename Arg>
+struct ArgWidth<Arg, typename std::enable_if<IsAggregateRow<Arg>::value>::type>
+    : FieldsWidth<decltype(field_refs(std::declval<const Arg&>()))> {};
+
+template <typename Row, typename Enable = void>
+struct RowWidth : ArgWidth<Row> {};
+
+template <typename Row>
+struct RowWidth<Row, typename std::enable_if<IsTupleLike<Row>::value>::type>
+    : FieldsWidth<Row> {};
+
+template <bool isRestEmpty, typename T, typename... Rest>
+struct ValueType;
+
+template <typename T, typename... Rest>
+struct ValueType<true, T, Rest...> {
+  typedef T type;
+};
+
+template <typename T, typename... Rest>
+struct ValueType<false, T, Rest...> {
+  typedef std::tuple<T, Rest...> type;
+};
+
+};  // namespace
+
+struct BatchStats {
+  size_t rows = 0;
+  size_t commits = 0;
+  double seconds = 0;
+
+  double rows_per_second() const { return seconds > 0 ? rows / seconds : 0; }
+};
+
+template <typename T, typename... Rest>
+class Iterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef typename ValueType<!sizeof...(Rest), T, Rest...>::type value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef value_type* pointer;
+  typedef value_type& reference;
+
+  Iterator() : stmt_(nullptr), id_(-1), vm_steps_(0) {}
+
+  Iterator(sqlite3_stmt* stmt) : stmt_(stmt), id_(-1), vm_steps_(0) {
+    operator++();
+  }
+
+  // Debug builds tell a copy left behind on an earlier row, whose views would
+  // point into the current one, from the iterator that stepped. The step
+  // count lives in the statement, so the check survives moving the cursor.
+  value_type operator*() const {
+    assert(id_ != -1 && vm_steps_ == vm_steps(stmt_));
+    return decode(stmt_);
+  }
+
+  template <int RestSize = sizeof...(Rest),
+            typename std::enable_if<(RestSize == 0)>::type*& = enabler>
+  static value_type decode(sqlite3_stmt* stmt) {
+    return RowValue<T>::get(stmt, 0);
+  }
+
+  template <int RestSize = sizeof...(Rest),
+            typename std::enable_if<(RestSize != 0)>::type*& = enabler>
+  static value_type decode(sqlite3_stmt* stmt) {
+    return ColumnValues<1 + sizeof...(Rest), T, Rest...>::get(stmt, 0);
+  }
+
+  Iterator& operator++() {
+    if (stmt_) {
+      auto rc = sqlite3_step(stmt_);
+#ifndef NDEBUG
+      vm_steps_ = vm_steps(stmt_);
+#endif
+      if (rc == SQLITE_ROW) {
+        ++id_;
+      } else if (rc == SQLITE_DONE) {
+        sqlite3_reset(stmt_);
+        id_ = -1;
+      } else {
+        SQLITELIB_THROW(Exception(make_error(stmt_, rc)));
+      }
+    } else {
+      SQLITELIB_THROW(
+          Exception(Error{SQLITE_MISUSE, SQLITE_MISUSE, std::string()}));
+    }
+    return *this;
+  }
+
+  bool operator==(const Iterator& rhs) { return id_ == rhs.id_; }
+
+  bool operator!=(const Iterator& rhs) { return !operator==(rhs); }
+
+ private:
+  // Every step runs at least one instruction.
+  static int vm_steps(sqlite3_stmt* stmt) {
+#ifndef NDEBUG
+    return sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+#else
+    (void)stmt;
+    return 0;
+#endif
+  }
+
+  sqlite3_stmt* stmt_;
+  int id_;
+  int vm_steps_;
+};
+
+// Resets a statement on scope exit so that an idle statement does not keep
+// its read transaction open.
+struct StatementResetter {
+  StatementResetter(sqlite3_stmt* stmt) : stmt_(stmt) {}
+  ~StatementResetter() { sqlite3_reset(stmt_); }
+
+  sqlite3_stmt* stmt_;
+};
+
+inline int try_new_sqlite3_stmt(sqlite3* db, const char* query,
+                                unsigned int flags, sqlite3_stmt** stmt) {
+  *stmt = nullptr;
+  return sqlite3_prepare_v3(db, query, static_cast<int>(strlen(query)), flags,
+                            stmt, nullptr);
+}
+
+inline sqlite3_stmt* new_sqlite3_stmt(sqlite3* db, const char* query,
+                                      unsigned int flags = 0) {
+  sqlite3_stmt* p = nullptr;
+  verify(db, try_new_sqlite3_stmt(db, query, flags, &p));
+  return p;
+}
+
+// Move-only reference to a prepared statement that either owns it or
+// borrows it from its owner (a Statement, the statement cache or a slot).
+// Borrowing from the cache pins the entry, so the cache neither hands the
+// statement out twice nor evicts it while the handle lives.
+class StatementHandle {
+ public:
+  StatementHandle() : stmt_(nullptr), owned_(false), pin_(nullptr) {}
+
+  explicit StatementHandle(sqlite3_stmt* stmt)
+      : stmt_(stmt), owned_(true), pin_(nullptr) {}
+
+  static StatementHandle borrow(sqlite3_stmt* stmt, bool* pin = nullptr) {
+    StatementHandle handle;
+    handle.stmt_ = stmt;
+    if (pin) {
+      *pin = true;
+      handle.pin_ = pin;
+    }
+    return handle;
+  }
+
+  StatementHandle(const StatementHandle&) = delete;
+  StatementHandle& operator=(const StatementHandle&) = delete;
+
+  StatementHandle(StatementHandle&& rhs) noexcept
+      : stmt_(rhs.stmt_), owned_(rhs.owned_), pin_(rhs.pin_) {
+    rhs.stmt_ = nullptr;
+    rhs.owned_ = false;
+    rhs.pin_ = nullptr;
+  }
+
+  StatementHandle& operator=(StatementHandle&& rhs) noexcept {
+    if (this != &rhs) {
+      release();
+      std::swap(stmt_, rhs.stmt_);
+      std::swap(owned_, rhs.owned_);
+      std::swap(pin_, rhs.pin_);
+    }
+    return *this;
+  }
+
+  ~StatementHandle() { release(); }
+
+  sqlite3_stmt* get() const { return stmt_; }
+
+  explicit operator bool() const { return stmt_ != nullptr; }
+
+ private:
+  // sqlite3_finalize repeats the last step error but always frees.
+  void release() {
+    if (owned_) {
+      sqlite3_finalize(stmt_);
+    }
+    if (pin_) {
+      *pin_ = false;
+    }
+    stmt_ = nullptr;
+    owned_ = false;
+    pin_ = nullptr;
+  }
+
+  sqlite3_stmt* stmt_;
+  bool owned_;
+  bool* pin_;
+};
+
+class Sqlite;
+
+enum class TransactionMode { Deferred, Immediate, Exclusive };
+
+// Transaction control statements of one connection, prepared on first use and
+// reused afterwards. Savepoints are named after their nesting depth so that
+// each depth keeps its own statements.
+class TransactionControl {
+ public:
+  explicit TransactionControl(sqlite3* db)
+      : db_(db), depth_(0), open_(false) {}
+
+  void begin(TransactionMode mode) {
+    static const char* queries[] = {"BEGIN DEFERRED", "BEGIN IMMEDIATE",
+                                    "BEGIN EXCLUSIVE"};
+    auto i = static_cast<size_t>(mode);
+    run(begin_[i], queries[i]);
+    open_ = true;
+  }
+
+  // Also releases the savepoints opened inside the transaction.
+  void commit() {
+    run(commit_, "COMMIT");
+    depth_ = 0;
+    open_ = false;
+  }
+
+  // Also discards the savepoints opened inside the transaction. Succeeds
+  // when SQLite already rolled it back.
+  void rollback() {
+    open_ = false;
+    if (!sqlite3_get_autocommit(db_)) {
+      run(rollback_, "ROLLBACK");
+    }
+    depth_ = 0;
+  }
+
+  // True when SQLite rolled back the transaction begun here by itself
+  // (INSERT OR ROLLBACK, SQLITE_FULL, an I/O error or an interrupt).
+  bool rolled_back() const { return open_ && sqlite3_get_autocommit(db_); }
+
+  // Opens a savepoint inside the innermost one and returns its depth. Fails
+  // after a rollback by SQLite, where it would start and commit a transaction
+  // of its own instead.
+  size_t savepoint() {
+    if (rolled_back()) {
+      SQLITELIB_THROW(Exception(Error{SQLITE_ABORT, SQLITE_ABORT_ROLLBACK,
+                                      "transaction was rolled back"}));
+    }
+    if (depth_ == levels_.size()) {
+      levels_.emplace_back(depth_);
+    }
+    auto& level = levels_[depth_];
+    run(level.savepoint, level.savepoint_query.c_str());
+    return depth_++;
+  }
+
+  // RELEASE and ROLLBACK TO also close the savepoints nested in `depth`.
+  void release(size_t depth) {
+    auto& level = levels_[depth];
+    run(level.release, level.release_query.c_str());
+    depth_ = depth;
+  }
+
+  void rollback_to(size_t depth) {
+    auto& level = levels_[depth];
+    run(level.rollback_to, level.rollback_to_query.c_str());
+    run(level.release, level.release_query.c_str());
+    depth_ = depth;
+  }
+
+  // For destructors: errors are ignored, and nothing is run when SQLite has
+  // already rolled the transaction back by itself (INSERT OR ROLLBACK,
+  // SQLITE_FULL, an I/O error or an interrupt).
+  void abandon() noexcept {
+    if (!sqlite3_get_autocommit(db_)) {
+      step(rollback_, "ROLLBACK");
+    }
+    depth_ = 0;
+    open_ = false;
+  }
+
+  void abandon_to(size_t depth) noexcept {
+    if (sqlite3_get_autocommit(db_)) {
+      depth_ = 0;
+      return;
+    }
+    auto& level = levels_[depth];
+    step(level.rollback_to, level.rollback_to_query.c_str());
+    step(level.release, level.release_query.c_str());
+    depth_ = depth;
+  }
+
+  // Number of open savepoints
+  size_t depth() const { return depth_; }
+
+ private:
+  struct Level {
+    explicit Level(size_t depth) {
+      auto name = "sqlitelib_" + std::to_string(depth);
+      savepoint_query = "SAVEPOINT " + name;
+      release_query = "RELEASE " + name;
+      rollback_to_query = "ROLLBACK TO " + name;
+    }
+
+    std::string savepoint_query;
+    std::string release_query;
+    std::string rollback_to_query;
+    StatementHandle savepoint;
+    StatementHandle release;
+    StatementHandle rollback_to;
+  };
+
+  void run(StatementHandle& stmt, const char* query) {
+    verify(db_, step(stmt, query), SQLITE_DONE);
+  }
+
+  int step(StatementHandle& stmt, const char* query) noexcept {
+    if (!stmt) {
+      sqlite3_stmt* p = nullptr;
+      auto rc = sqlite3_prepare_v3(db_, query, -1, SQLITE_PREPARE_PERSISTENT,
+                                   &p, nullptr);
+      if (rc != SQLITE_OK) {
+        return rc;
+      }
+      stmt = StatementHandle(p);
+    }
+    auto rc = sqlite3_step(stmt.get());
+    sqlite3_reset(stmt.get());
+    return rc;
+  }
+
+  sqlite3* db_;
+  StatementHandle begin_[3];
+  StatementHandle commit_;
+  StatementHandle rollback_;
+  std::vector<Level> levels_;
+  size_t depth_;
+  bool open_;  // a transaction begun here is not committed or rolled back
+};
+
+class Transaction {
+ public:
+  Transaction(const Transaction&) = delete;
+  Transaction& operator=(const Transaction&) = delete;
+
+  explicit Transaction(Sqlite& db,
+                       TransactionMode mode = TransactionMode::Deferred);
+
+  explicit Transaction(TransactionControl& control,
+                       TransactionMode mode = TransactionMode::Deferred)
+      : control_(control), active_(false) {
+    control_.begin(mode);
+    active_ = true;
+  }
+
+  ~Transaction() {
+    if (active_) {
+      control_.abandon();
+    }
+  }
+
+  // A failed commit leaves the transaction open for a retry or rollback.
+  void commit() {
+    control_.commit();
+    active_ = false;
+  }
+
+  void rollback() {
+    active_ = false;
+    control_.rollback();
+  }
+
+  bool active() const { return active_; }
+
+  // SQLite rolled the transaction back by itself; commit() fails and
+  // rollback() just closes it.
+  bool rolled_back() const { return active_ && control_.rolled_back(); }
+
+ private:
+  TransactionControl& control_;
+  bool active_;
+};
+
+// Starts a transaction of its own when none is open.
+class Savepoint {
+ public:
+  Savepoint(const Savepoint&) = delete;
+  Savepoint& operator=(const Savepoint&) = delete;
+
+  explicit Savepoint(Sqlite& db);
+
+  explicit Savepoint(TransactionControl& control)
+      : control_(control), depth_(control_.savepoint()), active_(true) {}
+
+  // Skipped when an enclosing rollback already discarded the savepoint
+  ~Savepoint() {
+    if (active_ && control_.depth() > depth_) {
+      control_.abandon_to(depth_);
+    }
+  }
+
+  void release() {
+    control_.release(depth_);
+    active_ = false;
+  }
+
+  void rollback() {
+    active_ = false;
+    control_.rollback_to(depth_);
+  }
+
+  bool active() const { return active_; }
+
+ private:
+  TransactionControl& control_;
+  size_t depth_;
+  bool active_;
+};
+
+// Buffers moved into a statement for one parameter and bound without a
+// copy. They travel with the statement handle into a result reader that
+// takes it over, and must outlive it.
+struct OwnedBuffer {
+  std::string text;
+  std::vector<char> blob;
+};
+
+typedef std::vector<OwnedBuffer> OwnedBuffers;
+
+template <typename T, typename... Rest>
+class Cursor {
+ public:
+  Cursor() = delete;
+  Cursor(const Cursor&) = delete;
+  Cursor& operator=(const Cursor&) = delete;
+
+  // Iterators taken from `rhs` keep working on the moved cursor.
+  Cursor(Cursor&& rhs)
+      : buffers_(std::move(rhs.buffers_)), stmt_(std::move(rhs.stmt_)) {}
+
+  Cursor(StatementHandle stmt, OwnedBuffers buffers = OwnedBuffers())
+      : buffers_(std::move(buffers)), stmt_(std::move(stmt)) {}
+
+  // Ends the read transaction of a cursor abandoned mid-iteration.
+  ~Cursor() {
+    if (stmt_) {
+      sqlite3_reset(stmt_.get());
+    }
+  }
+
+  // Rows, and the views into them, are valid until the cursor steps again.
+  Iterator<T, Rest...> begin() { return Iterator<T, Rest...>(stmt_.get()); }
+
+  Iterator<T, Rest...> end() { return Iterator<T, Rest...>(); }
+
+ private:
+  OwnedBuffers buffers_;
+  StatementHandle stmt_;
+};
+
+// Apache Arrow C data interface
+// (https://arrow.apache.org/docs/format/CDataInterface.html)
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+enum class ArrowType {
+  Int32,
+  Int64,
+  Double,
+  Utf8,
+  Binary,
+  Float,
+  UInt32,
+  Boolean,
+  Int8,
+  Int16,
+  UInt8,
+  UInt16
+};
+
+namespace {
+
+template <typename T, typename = void>
+struct ArrowTypeOf;
+
+template <>
+struct ArrowTypeOf<int> {
+  static const ArrowType value = ArrowType::Int32;
+};
+
+template <typename T>
+struct ArrowTypeOf<T, typename std::enable_if<std::is_integral<T>::value &&
+                                              sizeof(T) == 8>::type> {
+  static const ArrowType value = ArrowType::Int64;
+};
+
+template <typename T>
+struct ArrowTypeOf<T, typename std::enable_if<std::is_unsigned<T>::value &&
+                                              sizeof(T) == 4>::type> {
+  static const ArrowType value = ArrowType::UInt32;
+};
+
+template <typename T>
+struct ArrowTypeOf<T, typename std::enable_if<std::is_integral<T>::value &&
+                                              sizeof(T) == 1>::type> {
+  static const ArrowType value =
+      std::is_signed<T>::value ? ArrowType::Int8 : ArrowType::UInt8;
+};
+
+template <typename T>
+struct ArrowTypeOf<T, typename std::enable_if<std::is_integral<T>::value &&
+                                              sizeof(T) == 2>::type> {
+  static const ArrowType value =
+      std::is_signed<T>::value ? ArrowType::Int16 : ArrowType::UInt16;
+};
+
+template <>
+struct ArrowTypeOf<bool> {
+  static const ArrowType value = ArrowType::Boolean;
+};
+
+template <>
+struct ArrowTypeOf<double> {
+  static const ArrowType value = ArrowType::Double;
+};
+
+template <>
+struct ArrowTypeOf<float> {
+  static const ArrowType value = ArrowType::Float;
+};
+
+// Arrow columns are nullable through their validity bitmap.
+template <typename T>
+struct ArrowTypeOf<std::optional<T>> : ArrowTypeOf<T> {};
+
+template <>
+struct ArrowTypeOf<std::string> {
+  static const ArrowType value = ArrowType::Utf8;
+};
+
+template <>
+struct ArrowTypeOf<std::vector<char>> {
+  static const ArrowType value = ArrowType::Binary;
+};
+
+inline const char* arrow_format(ArrowType type) {
+  switch (type) {
+    case ArrowType::Int32:
+      return "i";
+    case ArrowType::Int64:
+      return "l";
+    case ArrowType::Double:
+      return "g";
+    case ArrowType::Utf8:
+      return "U";
+    case ArrowType::Float:
+      return "f";
+    case ArrowType::UInt32:
+      return "I";
+    case ArrowType::Boolean:
+      return "b";
+    case ArrowType::Int8:
+      return "c";
+    case ArrowType::Int16:
+      return "s";
+    case ArrowType::UInt8:
+      return "C";
+    case ArrowType::UInt16:
+      return "S";
+    case ArrowType::Binary:
+      return "Z";
+  }
+  // No default above, so that -Wswitch reports a missing enumerator
+  return "Z";
+}
+
+// Column type affinity rules of https://www.sqlite.org/datatype3.html. A
+// NUMERIC column stores integers as integers, so it follows the type of
+// `first`, the storage class of its first value.
+inline ArrowType arrow_type_from_decltype(const char* decl, int first) {
+  auto type = std::string(decl);
+  for (auto& c : type) {
+    c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+  }
+  auto has = [&](const char* s) { return type.find(s) != std::string::npos; };
+  if (has("INT")) {
+    return ArrowType::Int64;
+  }
+  if (has("CHAR") || has("CLOB") || has("TEXT")) {
+    return ArrowType::Utf8;
+  }
+  if (type.empty() || has("BLOB")) {
+    return ArrowType::Binary;
+  }
+  if (has("REAL") || has("FLOA") || has("DOUB")) {
+    return ArrowType::Double;
+  }
+  return first == SQLITE_INTEGER ? ArrowType::Int64 : ArrowType::Double;
+}
+
+inline ArrowType arrow_type_from_value(int type) {
+  switch (type) {
+    case SQLITE_INTEGER:
+      return ArrowType::Int64;
+    case SQLITE_FLOAT:
+      return ArrowType::Double;
+    case SQLITE_BLOB:
+      return ArrowType::Binary;
+    default:
+      return ArrowType::Utf8;
+  }
+}
+
+// Buffers of one exported column, owned by its ArrowArray
+struct ArrowColumnData {
+  ArrowColumnData(ArrowType type) : type(type) {
+    validity.reserve(1);
+    values.reserve(1);
+    data.reserve(1);
+    if (is_variable()) {
+      offsets.push_back(0);
+    }
+  }
+
+  bool is_variable() const {
+    return type == ArrowType::Utf8 || type == ArrowType::Binary;
+  }
+
+  void append(sqlite3_stmt* stmt, int col) {
+    if (length % 8 == 0) {
+      validity.push_back(0);
+    }
+    auto valid = sqlite3_column_type(stmt, col) != SQLITE_NULL;
+    if (valid) {
+      validity.back() |= static_cast<uint8_t>(1 << (length % 8));
+    } else {
+      ++null_count;
+    }
+    ++length;
+
+    switch (type) {
+      case ArrowType::Int32:
+        push(valid ? sqlite3_column_int(stmt, col) : 0);
+        break;
+      case ArrowType::Int64:
+        push(valid ? sqlite3_column_int64(stmt, col) : sqlite3_int64(0));
+        break;
+      case ArrowType::Double:
+        push(valid ? sqlite3_column_double(stmt, col) : 0.0);
+        break;
+      case ArrowType::Utf8:
+        append_bytes(sqlite3_column_text(stmt, col),
+                     sqlite3_column_bytes(stmt, col));
+        break;
+      case ArrowType::Binary:
+        append_bytes(sqlite3_column_blob(stmt, col),
+                     sqlite3_column_bytes(stmt, col));
+        break;
+      case ArrowType::Float:
+        push(valid ? static_cast<float>(sqlite3_column_double(stmt, col))
+                   : 0.0f);
+        break;
+      case ArrowType::UInt32:
+        push(valid ? static_cast<uint32_t>(sqlite3_column_int64(stmt, col))
+                   : uint32_t(0));
+        break;
+      case ArrowType::Int8:
+        push(valid ? static_cast<int8_t>(sqlite3_column_int(stmt, col))
+                   : int8_t(0));
+        break;
+      case ArrowType::Int16:
+        push(valid ? static_cast<int16_t>(sqlite3_column_int(stmt, col))
+                   : int16_t(0));
+        break;
+      case ArrowType::UInt8:
+        push(valid ? static_cast<uint8_t>(sqlite3_column_int(stmt, col))
+                   : uint8_t(0));
+        break;
+      case ArrowType::UInt16:
+        push(valid ? static_cast<uint16_t>(sqlite3_column_int(stmt, col))
+                   : uint16_t(0));
+        break;
+      case ArrowType::Boolean:
+        // Bit-packed like the validity bitmap
+        if ((length - 1) % 8 == 0) {
+          values.push_back(0);
+        }
+        if (valid && sqlite3_column_int(stmt, col)) {
+          values.back() |= static_cast<char>(1 << ((length - 1) % 8));
+        }
+        break;
+    }
+  }
+
+  template <typename V>
+  void push(V val) {
+    auto p = reinterpret_cast<const char*>(&val);
+    values.insert(values.end(), p, p + sizeof(V));
+  }
+
+  void append_bytes(const void* p, int bytes) {
+    if (bytes > 0) {
+      auto first = static_cast<const char*>(p);
+      data.insert(data.end(), first, first + bytes);
+    }
+    offsets.push_back(static_cast<int64_t>(data.size()));
+  }
+
+  void export_to(ArrowArray* out) {
+    buffers[0] = null_count ? validity.data() : nullptr;
+    if (is_variable()) {
+      buffers[1] = offsets.data();
+      buffers[2] = data.data();
+    } else {
+      buffers[1] = values.data();
+    }
+
+    out->length = length;
+    out->null_count = null_count;
+    out->offset = 0;
+    out->n_buffers = is_variable() ? 3 : 2;
+    out->n_children = 0;
+    out->buffers = buffers;
+    out->children = nullptr;
+    out->dictionary = nullptr;
+    out->release = release;
+    out->private_data = this;
+  }
+
+  static void release(ArrowArray* array) {
+    delete static_cast<ArrowColumnData*>(array->private_data);
+    array->release = nullptr;
+  }
+
+  ArrowType type;
+  int64_t length = 0;
+  int64_t null_count = 0;
+  std::vector<uint8_t> validity;
+  std::vector<char> values;
+  std::vector<int64_t> offsets;
+  std::vector<char> data;
+  const void* buffers[3] = {};
+};
+
+// Top-level struct array of a record batch, owning its children
+struct ArrowBatchData {
+  static void release(ArrowArray* array) {
+    auto self = static_cast<ArrowBatchData*>(array->private_data);
+    for (auto& child : self->children) {
+      if (child.release) {
+        child.release(&child);
+      }
+    }
+    delete self;
+    array->release = nullptr;
+  }
+
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray*> pointers;
+  const void* buffers[1] = {nullptr};
+};
+
+struct ArrowSchemaData {
+  static void release(ArrowSchema* schema) {
+    auto self = static_cast<ArrowSchemaData*>(schema->private_data);
+    for (auto& child : self->children) {
+      if (child.release) {
+        child.release(&child);
+      }
+    }
+    delete self;
+    schema->release = nullptr;
+  }
+
+  static void release_child(ArrowSchema* schema) {
+    delete static_cast<std::string*>(schema->private_data);
+    schema->release = nullptr;
+  }
+
+  std::vector<ArrowSchema> children;
+  std::vector<ArrowSchema*> pointers;
+};
+
+};  // namespace
+
+// Runs a statement and exports its rows as Arrow record batches (struct
+// arrays with one child per result column). Column types come from the
+// Statement template parameters, or from the declared column types for
+// Statement<void>.
+class ArrowReader {
+ public:
+  ArrowReader(StatementHandle stmt, std::vector<ArrowType> types,
+              size_t batch_rows, OwnedBuffers buffers = OwnedBuffers())
+      : buffers_(std::move(buffers)),
+        stmt_(std::move(stmt)),
+        types_(types),
+        batch_rows_(std::max<size_t>(batch_rows, 1)),
+        done_(false) {
+    step();
+    if (types_.empty()) {
+      auto columns = sqlite3_column_count(stmt_.get());
+      for (auto col = 0; col < columns; col++) {
+        auto decl = sqlite3_column_decltype(stmt_.get(), col);
+        auto first =
+            done_ ? SQLITE_NULL : sqlite3_column_type(stmt_.get(), col);
+        if (decl) {
+          types_.push_back(arrow_type_from_decltype(decl, first));
+        } else if (!done_) {
+          types_.push_back(arrow_type_from_value(first));
+        } else {
+          types_.push_back(ArrowType::Utf8);
+        }
+      }
+    }
+  }
+
+  ArrowReader(ArrowReader&& rhs) = default;
+
+  ~ArrowReader() {
+    if (stmt_) {
+      sqlite3_reset(stmt_.get());
+    }
+  }
+
+  const std::vector<ArrowType>& types() const { return types_; }
+
+  void get_schema(ArrowSchema* out) const {
+    auto self = new ArrowSchemaData();
+    self->children.resize(types_.size());
+    for (size_t i = 0; i < types_.size(); i++) {
+      auto name = new std::string(
+          sqlite3_column_name(stmt_.get(), static_cast<int>(i)));
+      auto& child = self->children[i];
+      child = ArrowSchema();
+      child.format = arrow_format(types_[i]);
+      child.name = name->c_str();
+      child.flags = ARROW_FLAG_NULLABLE;
+      child.release = ArrowSchemaData::release_child;
+      child.private_data = name;
+      self->pointers.push_back(&child);
+    }
+
+    *out = ArrowSchema();
+    out->format = "+s";
+    out->name = "";
+    out->n_children = static_cast<int64_t>(types_.size());
+    out->children = self->pointers.data();
+    out->release = ArrowSchemaData::release;
+    out->private_data = self;
+  }
+
+  // Fills `out` with the next batch of at most batch_rows rows. Returns false
+  // once the result is exhausted.
+  bool next(ArrowArray* out) {
+    if (done_) {
+      return false;
+    }
+
+    std::vector<std::unique_ptr<ArrowColumnData>> columns;
+    for (auto type : types_) {
+      columns.emplace_back(new ArrowColumnData(type));
+    }
+
+    int64_t rows = 0;
+    while (!done_ && static_cast<size_t>(rows) < batch_rows_) {
+      for (size_t i = 0; i < columns.size(); i++) {
+        columns[i]->append(stmt_.get(), static_cast<int>(i));
+      }
+      ++rows;
+      step();
+    }
+
+    auto self = new ArrowBatchData();
+    self->children.resize(columns.size());
+    for (size_t i = 0; i < columns.size(); i++) {
+      columns[i].release()->export_to(&self->children[i]);
+      self->pointers.push_back(&self->children[i]);
+    }
+
+    *out = ArrowArray();
+    out->length = rows;
+    out->n_buffers = 1;
+    out->n_children = static_cast<int64_t>(columns.size());
+    out->buffers = self->buffers;
+    out->children = self->pointers.data();
+    out->release = ArrowBatchData::release;
+    out->private_data = self;
+    return true;
+  }
+
+ private:
+  void step() {
+    auto rc = sqlite3_step(stmt_.get());
+    if (rc == SQLITE_DONE) {
+      done_ = true;
+    } else {
+      verify(stmt_.get(), rc, SQLITE_ROW);
+    }
+  }
+
+  OwnedBuffers buffers_;
+  StatementHandle stmt_;
+  std::vector<ArrowType> types_;
+  size_t batch_rows_;
+  bool done_;
+};
+
+// Cursor that steps and decodes rows on a producer thread into a bounded
+// single-producer/single-consumer ring of `depth` rows, so that SQLite's
+// B-tree traversal overlaps with the consumer's own work. The connection
+// must not be used by other threads while the cursor is alive; with
+// no_mutex() (as in the presets) that includes the consuming thread inside
+// the loop. Destroying the cursor before the end cancels the producer,
+// interrupting a long step through a progress handler that the cursor
+// installs on the connection. It replaces any progress handler set by the
+// caller, and the connection has none after the cursor is destroyed. Errors
+// of the producer are rethrown by the consumer.
+template <typename T, typename... Rest>
+class PrefetchCursor {
+ public:
+  typedef typename ValueType<!sizeof...(Rest), T, Rest...>::type value_type;
+
+  class iterator {
+   public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef typename PrefetchCursor::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type* pointer;
+    typedef const value_type& reference;
+
+    iterator() : cursor_(nullptr) {}
+
+    iterator(PrefetchCursor* cursor) : cursor_(cursor) { operator++(); }
+
+    const value_type& operator*() const { return cursor_->current_; }
+
+    const value_type* operator->() const { return &cursor_->current_; }
+
+    iterator& operator++() {
+      if (!cursor_->pop()) {
+        cursor_ = nullptr;
+      }
+      return *this;
+    }
+
+    bool operator==(const iterator& rhs) const {
+      return cursor_ == rhs.cursor_;
+    }
+
+    bool operator!=(const iterator& rhs) const { return !operator==(rhs); }
+
+   private:
+    PrefetchCursor* cursor_;
+  };
+
+  PrefetchCursor(StatementHandle stmt, size_t depth,
+                 OwnedBuffers buffers = OwnedBuffers())
+      : buffers_(std::move(buffers)),
+        stmt_(std::move(stmt)),
+        slots_(std::max<size_t>(depth, 1)),
+        head_(0),
+        tail_(0),
+        finished_(false),
+        cancelled_(false),
+        producer_waiting_(false),
+        consumer_waiting_(false),
+        rc_(SQLITE_OK) {
+    static_assert(!AnyBorrowed<T, Rest...>::value,
+                  "views are only valid while iterating a cursor");
+    sqlite3_progress_handler(sqlite3_db_handle(stmt_.get()),
+                             ProgressInterval, cancelled, this);
+    producer_ = std::thread([this] { produce(); });
+  }
+
+  PrefetchCursor(const PrefetchCursor&) = delete;
+  PrefetchCursor& operator=(const PrefetchCursor&) = delete;
+
+  ~PrefetchCursor() {
+    cancelled_ = true;
+    wake(producer_waiting_, producer_cv_);
+    producer_.join();
+    sqlite3_progress_handler(sqlite3_db_handle(stmt_.get()), 0, nullptr,
+                             nullptr);
+    sqlite3_reset(stmt_.get());
+  }
+
+  iterator begin() { return iterator(this); }
+
+  iterator end() { return iterator(); }
+
+ private:
+  // Number of virtual machine instructions between cancellation checks
+  static const int ProgressInterval = 1000;
+
+  static int cancelled(void* cursor) {
+    return static_cast<PrefetchCursor*>(cursor)->cancelled_ ? 1 : 0;
+  }
+
+  void produce() {
+    SQLITELIB_TRY {
+      for (;;) {
+        auto rc = sqlite3_step(stmt_.get());
+        if (rc != SQLITE_ROW) {
+          rc_ = rc;
+          break;
+        }
+
+        auto tail = tail_.load();
+        wait(producer_waiting_, producer_cv_, [&] {
+          return cancelled_ || tail - head_.load() < slots_.size();
+        });
+        if (cancelled_) {
+          break;
+        }
+
+        slots_[tail % slots_.size()] =
+            Iterator<T, Rest...>::decode(stmt_.get());
+        tail_.store(tail + 1);
+        wake(consumer_waiting_, consumer_cv_);
+      }
+    } SQLITELIB_CATCH_ALL {
+      error_ = std::current_exception();
+    }
+
+    finished_ = true;
+    wake(consumer_waiting_, consumer_cv_);
+  }
+
+  // Returns false at the end of the result.
+  bool pop() {
+    auto head = head_.load();
+    wait(consumer_waiting_, consumer_cv_,
+         [&] { return finished_ || tail_.load() != head; });
+    if (tail_.load() == head) {
+      if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+      }
+      verify(stmt_.get(), rc_, SQLITE_DONE);
+      return false;
+    }
+
+    current_ = std::move(slots_[head % slots_.size()]);
+    head_.store(head + 1);
+    wake(producer_waiting_, producer_cv_);
+    return true;
+  }
+
+  // Spins briefly, then sleeps until `ready` holds. The other side only
+  // takes the mutex when this side has announced that it is sleeping.
+  template <typename Ready>
+  void wait(std::atomic<bool>& waiting, std::condition_variable& cv,
+            Ready ready) {
+    for (auto i = 0; i < 64; i++) {
+      if (ready()) {
+        return;
+      }
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiting = true;
+    cv.wait(lock, ready);
+    waiting = false;
+  }
+
+  void wake(std::atomic<bool>& waiting, std::condition_variable& cv) {
+    if (waiting) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv.notify_one();
+    }
+  }
+
+  OwnedBuffers buffers_;
+  StatementHandle stmt_;
+  std::vector<value_type> slots_;
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  std::atomic<bool> finished_;
+  std::atomic<bool> cancelled_;
+  std::atomic<bool> producer_waiting_;
+  std::atomic<bool> consumer_waiting_;
+  std::mutex mutex_;
+  std::condition_variable producer_cv_;
+  std::condition_variable consumer_cv_;
+  std::thread producer_;
+  value_type current_;
+  int rc_;
+  std::exception_ptr error_;
+};
+
+template <typename T, typename... Rest>
+class Statement {
+ public:
+  // execute_many uses the transaction statements of `control`, the ones of
+  // the connection for statements prepared by a Sqlite.
+  Statement(sqlite3* db, const char* query,
+            TransactionControl* control = nullptr)
+      : stmt_(new_sqlite3_stmt(db, query)), control_(control) {}
+
+  Statement(StatementHandle stmt, TransactionControl* control = nullptr)
+      : stmt_(std::move(stmt)), control_(control) {}
+
+  Statement(Statement&& rhs)
+      : owned_(std::move(rhs.owned_)),
+        stmt_(std::move(rhs.stmt_)),
+        control_(rhs.control_),
+        own_control_(std::move(rhs.own_control_)),
+        rows_hint_(rhs.rows_hint_),
+        lent_(false) {
+    assert(!rhs.lent_ && "a cursor still borrows the statement");
+  }
+
+  Statement() = delete;
+  Statement(const Statement& rhs) = delete;
+
+  ~Statement() {
+    assert(!lent_ && "a cursor still borrows the statement");
+  }
+
+  template <typename... Args>
+  Statement<T, Rest...>& bind(Args&&... args) {
+    verify(stmt_.get(), sqlite3_reset(stmt_.get()));
+    auto rc = SQLITE_OK;
+    bind_values(1, SQLITE_TRANSIENT, rc, std::forward<Args>(args)...);
+    verify(stmt_.get(), rc);
+    return *this;
+  }
+
+  template <
+      typename U = T,
+      typename std::enable_if<std::is_same<U, void>::value>::type*& = enabler,
+      typename... Args>
+  void execute(const Args&... args) {
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    bind_static(args...);
+    verify(stmt_.get(), sqlite3_step(stmt_.get()), SQLITE_DONE);
+  }
+
+  // Executes the statement once per element of `rows` (tuples or single
+  // values) inside one transaction, committing every `commit_every` rows
+  // when it is not zero. Inside an open transaction the rows simply join it.
+  // Transactions are begun with their first row, so no empty one is run.
+  template <
+      typename Range, typename U = T,
+      typename std::enable_if<std::is_same<U, void>::value>::type*& = enabler>
+  BatchStats execute_many(const Range& rows, size_t commit_every = 0) {
+    auto start = std::chrono::steady_clock::now();
+    auto db = sqlite3_db_handle(stmt_.get());
+    auto own_transaction = sqlite3_get_autocommit(db) != 0;
+
+    // The rows rebind the parameters, so buffers moved in before are freed.
+    sqlite3_clear_bindings(stmt_.get());
+    owned_.clear();
+
+    BatchStats stats;
+    {
+      BindingsClearer<true> clearer(stmt_.get());
+      std::optional<Transaction> tx;
+      StatementResetter resetter(stmt_.get());
+
+      for (const auto& row : rows) {
+        if (own_transaction && !tx) {
+          tx.emplace(transaction_control(), TransactionMode::Immediate);
+        }
+        verify(stmt_.get(), sqlite3_reset(stmt_.get()));
+        auto rc = SQLITE_OK;
+        bind_row(stmt_.get(), 1, row, rc);
+        verify(stmt_.get(), rc);
+        verify(stmt_.get(), sqlite3_step(stmt_.get()), SQLITE_DONE);
+        ++stats.rows;
+
+        if (own_transaction && commit_every &&
+            stats.rows % commit_every == 0) {
+          tx->commit();
+          ++stats.commits;
+          tx.reset();
+        }
+      }
+
+      if (tx) {
+        tx->commit();
+        ++stats.commits;
+      }
+    }
+
+    stats.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    return stats;
+  }
+
+  template <
+      typename U = T,
+      typename std::enable_if<!std::is_same<U, void>::value>::type*& = enabler,
+      typename V = typename ValueType<!sizeof...(Rest), T, Rest...>::type,
+      typename... Args>
+  std::vector<V> execute(const Args&... args) {
+    static_assert(!AnyBorrowed<T, Rest...>::value,
+                  "views are only valid while iterating a cursor");
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    bind_static(args...);
+    StatementResetter resetter(stmt_.get());
+    // Sized after the previous result, which is usually close.
+    std::vector<V> ret;
+    ret.reserve(rows_hint_);
+    for (;;) {
+      auto rc = sqlite3_step(stmt_.get());
+      if (rc != SQLITE_ROW) {
+        verify(stmt_.get(), rc, SQLITE_DONE);
+        break;
+      }
+      ret.push_back(Iterator<T, Rest...>::decode(stmt_.get()));
+    }
+    rows_hint_ = ret.size();
+    return ret;
+  }
+
+  // Non-throwing counterparts of execute and execute_value. Failures such as
+  // SQLITE_BUSY, SQLITE_CONSTRAINT or SQLITE_RANGE from binding are returned
+  // as an Error.
+  template <
+      typename U = T,
+      typename std::enable_if<std::is_same<U, void>::value>::type*& = enabler,
+      typename... Args>
+  Result<void> try_execute(const Args&... args) {
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    if (auto rc = try_bind_static(args...)) {
+      return make_error(stmt_.get(), rc);
+    }
+    auto rc = sqlite3_step(stmt_.get());
+    if (rc != SQLITE_DONE) {
+      auto error = make_error(stmt_.get(), rc);
+      sqlite3_reset(stmt_.get());
+      return error;
+    }
+    return Result<void>();
+  }
+
+  template <
+      typename U = T,
+      typename std::enable_if<!std::is_same<U, void>::value>::type*& = enabler,
+      typename V = typename ValueType<!sizeof...(Rest), T, Rest...>::type,
+      typename... Args>
+  Result<std::vector<V>> try_execute(const Args&... args) {
+    static_assert(!AnyBorrowed<T, Rest...>::value,
+                  "views are only valid while iterating a cursor");
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    if (auto rc = try_bind_static(args...)) {
+      return make_error(stmt_.get(), rc);
+    }
+    StatementResetter resetter(stmt_.get());
+    std::vector<V> ret;
+    for (;;) {
+      auto rc = sqlite3_step(stmt_.get());
+      if (rc == SQLITE_ROW) {
+        ret.push_back(Iterator<T, Rest...>::decode(stmt_.get()));
+      } else if (rc == SQLITE_DONE) {
+        return ret;
+      } else {
+        return make_error(stmt_.get(), rc);
+      }
+    }
+  }
+
+  // An empty result is reported as SQLITE_DONE.
+  template <typename... Args>
+  Result<T> try_execute_value(const Args&... args) {
+    static_assert(!AnyBorrowed<T>::value,
+                  "views are only valid while iterating a cursor");
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    if (auto rc = try_bind_static(args...)) {
+      return make_error(stmt_.get(), rc);
+    }
+    StatementResetter resetter(stmt_.get());
+    auto rc = sqlite3_step(stmt_.get());
+    if (rc == SQLITE_ROW) {
+      return Iterator<T>::decode(stmt_.get());
+    }
+    return make_error(stmt_.get(), rc);
+  }
+
+  // Steps the statement as bound by bind(). Yields the next row, or nothing
+  // once the result is exhausted.
+  template <
+      typename U = T,
+      typename std::enable_if<!std::is_same<U, void>::value>::type*& = enabler,
+      typename V = typename ValueType<!sizeof...(Rest), T, Rest...>::type>
+  Result<std::optional<V>> try_step() {
+    auto rc = sqlite3_step(stmt_.get());
+    if (rc == SQLITE_ROW) {
+      return std::optional<V>(Iterator<T, Rest...>::decode(stmt_.get()));
+    }
+    if (rc == SQLITE_DONE) {
+      return std::optional<V>();
+    }
+    auto error = make_error(stmt_.get(), rc);
+    sqlite3_reset(stmt_.get());
+    return error;
+  }
+
+  template <typename... Args>
+  T execute_value(const Args&... args) {
+    static_assert(!AnyBorrowed<T>::value,
+                  "views are only valid while iterating a cursor");
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    bind_static(args...);
+    StatementResetter resetter(stmt_.get());
+    auto rc = sqlite3_step(stmt_.get());
+    if (rc != SQLITE_ROW) {
+      verify(stmt_.get(), rc, SQLITE_DONE);
+    }
+    // An empty result decodes like a row of NULLs
+    return Iterator<T, Rest...>::decode(stmt_.get());
+  }
+
+  // Materializes the result column by column (struct-of-arrays) instead of
+  // row by row.
+  template <typename... Args>
+  typename ColumnsType<!sizeof...(Rest), T, Rest...>::type execute_columns(
+      const Args&... args) {
+    static_assert(!AnyBorrowed<T, Rest...>::value,
+                  "views are only valid while iterating a cursor");
+    BindingsClearer<AnyBorrowable<Args...>::value> clearer(stmt_.get());
+    bind_static(args...);
+    StatementResetter resetter(stmt_.get());
+
+    typedef std::tuple<Column<T>, Column<Rest>...> Columns;
+    Columns columns;
+    for (;;) {
+      auto rc = sqlite3_step(stmt_.get());
+      if (rc == SQLITE_DONE) {
+        break;
+      }
+      verify(stmt_.get(), rc, SQLITE_ROW);
+      ColumnAppender<Columns>::append(stmt_.get(), columns);
+    }
+    return ColumnsType<!sizeof...(Rest), T, Rest...>::get(std::move(columns));
+  }
+
+  // The result readers below borrow the statement when it is called on an
+  // lvalue, which then has to outlive them, and take it over together with
+  // the buffers moved into it when it is called on a temporary, as in
+  //
+  //   for (const auto& x : db.prepare<int>("...").execute_cursor()) {}
+
+  // Exports the result as Arrow record batches of `batch_rows` rows (at
+  // least one).
+  template <typename... Args>
+  ArrowReader execute_arrow(size_t batch_rows, Args&&... args) & {
+    bind(std::forward<Args>(args)...);
+    return ArrowReader(borrow(), arrow_types<T, Rest...>(), batch_rows);
+  }
+
+  template <typename... Args>
+  ArrowReader execute_arrow(size_t batch_rows, Args&&... args) && {
+    bind(std::forward<Args>(args)...);
+    return ArrowReader(std::move(stmt_), arrow_types<T, Rest...>(),
+                       batch_rows, std::move(owned_));
+  }
+
+  // Iterates the result while a producer thread prefetches up to `depth`
+  // decoded rows.
+  template <typename... Args>
+  PrefetchCursor<T, Rest...> execute_prefetch(size_t depth,
+                                              Args&&... args) & {
+    bind(std::forward<Args>(args)...);
+    return PrefetchCursor<T, Rest...>(borrow(), depth);
+  }
+
+  template <typename... Args>
+  PrefetchCursor<T, Rest...> execute_prefetch(size_t depth,
+                                              Args&&... args) && {
+    bind(std::forward<Args>(args)...);
+    return PrefetchCursor<T, Rest...>(std::move(stmt_), depth,
+                                      std::move(owned_));
+  }
+
+  template <typename... Args>
+  Cursor<T, Rest...> execute_cursor(Args&&... args) & {
+    bind(std::forward<Args>(args)...);
+    return Cursor<T, Rest...>(borrow());
+  }
+
+  template <typename... Args>
+  Cursor<T, Rest...> execute_cursor(Args&&... args) && {
+    bind(std::forward<Args>(args)...);
+    return Cursor<T, Rest...>(std::move(stmt_), std::move(owned_));
+  }
+
+ private:
+  Statement& operator=(const Statement& rhs);
+
+  // Debug builds pin the statement while a reader borrows it, so that
+  // ~Statement can check that none outlives it.
+  StatementHandle borrow() const {
+#ifndef NDEBUG
+    return StatementHandle::borrow(stmt_.get(), &lent_);
+#else
+    return StatementHandle::borrow(stmt_.get());
+#endif
+  }
+
+  TransactionControl& transaction_control() {
+    if (!control_) {
+      own_control_.reset(
+          new TransactionControl(sqlite3_db_handle(stmt_.get())));
+      control_ = own_control_.get();
+    }
+    return *control_;
+  }
+
+  template <typename U, typename... URest,
+            typename std::enable_if<std::is_same<U, void>::value>::type*& =
+                enabler>
+  static std::vector<ArrowType> arrow_types() {
+    return std::vector<ArrowType>();
+  }
+
+  template <typename U, typename... URest,
+            typename std::enable_if<!std::is_same<U, void>::value>::type*& =
+                enabler>
+  static std::vector<ArrowType> arrow_types() {
+    return std::vector<ArrowType>{ArrowTypeOf<U>::value,
+                                  ArrowTypeOf<URest>::value...};
+  }
+
+  // The arguments outlive the step, so their buffers are not copied.
+  template <typename... Args>
+  void bind_static(const Args&... args) {
+    verify(stmt_.get(), try_bind_static(args...));
+  }
+
+  // Returns the result code of the reset or of the first failed bind.
+  template <typename... Args>
+  int try_bind_static(const Args&... args) {
+    auto rc = sqlite3_reset(stmt_.get());
+    if (rc == SQLITE_OK) {
+      bind_values(1, SQLITE_STATIC, rc, args...);
+    }
+    return rc;
+  }
+
+  void bind_values(int col, sqlite3_destructor_type lifetime, int& rc) {}
+
+  template <typename Arg, typename... ArgRest>
+  void bind_values(int col, sqlite3_destructor_type lifetime, int& rc,
+                   Arg&& val, ArgRest&&... rest) {
+    col = bind_owned(col, std::forward<Arg>(val), lifetime, rc);
+    bind_values(col, lifetime, rc, std::forward<ArgRest>(rest)...);
+  }
+
+  template <typename Arg>
+  int bind_owned(int col, Arg&& val, sqlite3_destructor_type lifetime,
+                 int& rc) {
+    auto next = bind_arg(stmt_.get(), col, val, lifetime, rc);
+    release_owned(col, next);
+    return next;
+  }
+
+  // A moved buffer is kept until its parameter is bound again or the
+  // statement is destroyed, so SQLite can use it without a copy.
+  int bind_owned(int col, std::string&& val, sqlite3_destructor_type lifetime,
+                 int& rc) {
+    if (lifetime != SQLITE_TRANSIENT || val.size() < OwnedBufferThreshold) {
+      return bind_owned(col, val, lifetime, rc);
+    }
+    auto& owned = owned_buffer(col);
+    owned.text = std::move(val);
+    std::vector<char>().swap(owned.blob);
+    bind_value(stmt_.get(), col, owned.text, SQLITE_STATIC, rc);
+    return col + 1;
+  }
+
+  int bind_owned(int col, std::vector<char>&& val,
+                 sqlite3_destructor_type lifetime, int& rc) {
+    if (lifetime != SQLITE_TRANSIENT || val.size() < OwnedBufferThreshold) {
+      return bind_owned(col, val, lifetime, rc);
+    }
+    auto& owned = owned_buffer(col);
+    owned.blob = std::move(val);
+    // Assigning an empty string would keep the old capacity.
+    std::string().swap(owned.text);
+    bind_value(stmt_.get(), col, owned.blob, SQLITE_STATIC, rc);
+    return col + 1;
+  }
+
+  OwnedBuffer& owned_buffer(int col) {
+    if (owned_.size() < static_cast<size_t>(col)) {
+      owned_.resize(col);
+    }
+    return owned_[col - 1];
+  }
+
+  // Frees the buffers moved into parameters [first, last) that were bound
+  // again by copy or by reference.
+  void release_owned(int first, int last) {
+    auto end = std::min(static_cast<size_t>(last - 1), owned_.size());
+    for (auto i = static_cast<size_t>(first - 1); i < end; i++) {
+      std::string().swap(owned_[i].text);
+      std::vector<char>().swap(owned_[i].blob);
+    }
+  }
+
+  // Declared before stmt_ so that the buffers outlive the finalization.
+  OwnedBuffers owned_;
+  StatementHandle stmt_;
+  TransactionControl* control_;
+  std::unique_ptr<TransactionControl> own_control_;
+  size_t rows_hint_ = 0;
+  mutable bool lent_ = false;
+};
+
+#if __cplusplus >= 202002L
+// SQL text usable as a template argument: db.stmt<"SELECT ...">()
+template <size_t N>
+struct fixed_string {
+  constexpr fixed_string(const char (&str)[N]) {
+    for (size_t i = 0; i < N; i++) {
+      value[i] = str[i];
+    }
+  }
+
+  char value[N];
+};
+
+inline size_t next_statement_slot() {
+  static std::atomic<size_t> slot(0);
+  return slot++;
+}
+
+// Each distinct SQL literal gets a process-wide slot index, assigned on its
+// first use. After that a lookup is a guarded load, and it does not depend
+// on the initialization order of translation units.
+template <fixed_string Sql>
+struct StatementSlot {
+  static size_t index() {
+    static const size_t index = next_statement_slot();
+    return index;
+  }
+};
+#endif
+
+namespace {
+
+// "name" with embedded quotes doubled, for names used verbatim in SQL
+inline std::string quote_identifier(const std::string& name) {
+  std::string quoted = "\"";
+  for (auto c : name) {
+    quoted += c;
+    if (c == '"') {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+};  // namespace
+
+// Inserts rows with multi-row `INSERT ... VALUES (?, ?), (?, ?), ...`
+// statements, binding many rows per step. The statement for a full batch
+// and the ones for the remainders are prepared once and reused. The table
+// and column names are quoted, so they are taken as they are and cannot
+// carry a schema prefix.
+class BatchInserter {
+ public:
+  static const size_t DefaultMaxRowsPerStatement = 256;
+
+  BatchInserter(sqlite3* db, const char* table,
+                const std::vector<std::string>& columns,
+                size_t max_rows_per_statement = DefaultMaxRowsPerStatement,
+                TransactionControl* control = nullptr)
+      : db_(db), columns_(columns.size()), control_(control) {
+    if (columns.empty()) {
+      SQLITELIB_THROW(std::invalid_argument("no columns"));
+    }
+
+    sql_ = "INSERT INTO " + quote_identifier(table) + " (";
+    for (size_t i = 0; i < columns.size(); i++) {
+      sql_ += (i ? ", " : "") + quote_identifier(columns[i]);
+    }
+    sql_ += ") VALUES ";
+
+    auto limit = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    rows_per_statement_ = std::max<size_t>(
+        1, std::min(static_cast<size_t>(limit) / columns_,
+                    max_rows_per_statement));
+    statements_.resize(rows_per_statement_ + 1);
+  }
+
+  size_t rows_per_statement() const { return rows_per_statement_; }
+
+  // Elements of `rows` must stay addressable while they are buffered, so the
+  // range has to yield lvalues (e.g. a std::vector of tuples).
+  template <typename Range>
+  BatchStats execute(const Range& rows) {
+    typedef typename std::remove_reference<decltype(*std::begin(rows))>::type
+        Row;
+    if (RowWidth<typename std::decay<Row>::type>::value != columns_) {
+      SQLITELIB_THROW(std::invalid_argument(
+          "rows bind " +
+          std::to_string(RowWidth<typename std::decay<Row>::type>::value) +
+          " values but " + std::to_string(columns_) +
+          " columns were given"));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto own_transaction = sqlite3_get_autocommit(db_) != 0;
+
+    BatchStats stats;
+    {
+      std::optional<Transaction> tx;
+      if (own_transaction) {
+        tx.emplace(transaction_control(), TransactionMode::Immediate);
+      }
+
+      std::vector<Row*> pending;
+      pending.reserve(rows_per_statement_);
+      for (auto& row : rows) {
+        pending.push_back(&row);
+        if (pending.size() == rows_per_statement_) {
+          flush(pending);
+          stats.rows += pending.size();
+          pending.clear();
+        }
+      }
+      if (!pending.empty()) {
+        flush(pending);
+        stats.rows += pending.size();
+      }
+
+      if (own_transaction) {
+        tx->commit();
+        ++stats.commits;
+      }
+    }
+
+    stats.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    return stats;
+  }
+
+ private:
+  template <typename Row>
+  void flush(const std::vector<Row*>& rows) {
+    auto stmt = statement(rows.size());
+    BindingsClearer<true> clearer(stmt);
+    StatementResetter resetter(stmt);
+
+    auto col = 1;
+    auto rc = SQLITE_OK;
+    for (auto row : rows) {
+      col = bind_row(stmt, col, *row, rc);
+    }
+    verify(stmt, rc);
+    verify(stmt, sqlite3_step(stmt), SQLITE_DONE);
+  }
+
+  TransactionControl& transaction_control() {
+    if (!control_) {
+      own_control_.reset(new TransactionControl(db_));
+      control_ = own_control_.get();
+    }
+    return *control_;
+  }
+
+  sqlite3_stmt* statement(size_t rows) {
+    auto& stmt = statements_[rows];
+    if (!stmt) {
+      auto sql = sql_;
+      for (size_t i = 0; i < rows; i++) {
+        sql += i ? ", (" : "(";
+        for (size_t j = 0; j < columns_; j++) {
+          sql += j ? ", ?" : "?";
+        }
+        sql += ")";
+      }
+      stmt = StatementHandle(
+          new_sqlite3_stmt(db_, sql.c_str(), SQLITE_PREPARE_PERSISTENT));
+    }
+    return stmt.get();
+  }
+
+  sqlite3* db_;
+  size_t columns_;
+  size_t rows_per_statement_;
+  std::string sql_;
+  std::vector<StatementHandle> statements_;
+  TransactionControl* control_;
+  std::unique_ptr<TransactionControl> own_control_;
+};
+
+struct StatementCacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+};
+
+// Bounded LRU cache of prepared statements keyed by SQL text.
+class StatementCache {
+ public:
+  StatementCache(size_t capacity) : capacity_(capacity) {}
+
+  StatementCache(const StatementCache&) = delete;
+  StatementCache& operator=(const StatementCache&) = delete;
+
+  StatementCache(StatementCache&& rhs) = default;
+
+  ~StatementCache() { clear(); }
+
+  // Returns a statement with cleared bindings, borrowed from the cache and
+  // pinned there until the handle is destroyed; Statement resets it when it
+  // binds the arguments. A statement that is already pinned by a live
+  // Statement or Cursor is never shared; a fresh one is prepared and owned
+  // by the handle.
+  StatementHandle get(sqlite3* db, const char* query) {
+    auto rc = SQLITE_OK;
+    auto stmt = get(db, query, rc);
+    verify(db, rc);
+    return stmt;
+  }
+
+  // Returns an empty handle and the result code in `rc` when the query
+  // cannot be prepared.
+  StatementHandle get(sqlite3* db, const char* query, int& rc) {
+    rc = SQLITE_OK;
+    purge_detached();
+    auto it = index_.find(std::string_view(query));
+    if (it != index_.end()) {
+      auto entry = it->second;
+      if (!entry->pinned) {
+        ++stats_.hits;
+        entries_.splice(entries_.begin(), entries_, entry);
+        sqlite3_clear_bindings(entry->stmt.get());
+        return StatementHandle::borrow(entry->stmt.get(), &entry->pinned);
+      }
+      ++stats_.misses;
+      sqlite3_stmt* stmt = nullptr;
+      rc = try_new_sqlite3_stmt(db, query, 0, &stmt);
+      return StatementHandle(stmt);
+    }
+
+    ++stats_.misses;
+    sqlite3_stmt* stmt = nullptr;
+    rc = try_new_sqlite3_stmt(db, query, SQLITE_PREPARE_PERSISTENT, &stmt);
+    if (rc != SQLITE_OK || capacity_ == 0) {
+      return StatementHandle(stmt);
+    }
+
+    entries_.push_front(Entry{query, StatementHandle(stmt), false});
+    auto& entry = entries_.front();
+    index_.emplace(std::string_view(entry.sql), entries_.begin());
+    shrink(capacity_);
+    return StatementHandle::borrow(stmt, &entry.pinned);
+  }
+
+  size_t size() const { return entries_.size(); }
+
+  size_t capacity() const { return capacity_; }
+
+  void set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    shrink(capacity_);
+  }
+
+  const StatementCacheStats& stats() const { return stats_; }
+
+  // Pinned statements leave the cache but stay alive until their borrower
+  // is done with them.
+  void clear() {
+    index_.clear();
+    while (!entries_.empty()) {
+      auto entry = std::prev(entries_.end());
+      if (entry->pinned) {
+        detached_.splice(detached_.end(), entries_, entry);
+      } else {
+        release(*entry);
+        entries_.erase(entry);
+      }
+    }
+    purge_detached();
+  }
+
+ private:
+  struct Entry {
+    std::string sql;
+    StatementHandle stmt;
+    bool pinned;
+  };
+
+  typedef std::list<Entry> Entries;
+
+  // Evicts least recently used entries that are not pinned; the cache may
+  // stay above `capacity` while pinned entries keep it full.
+  void shrink(size_t capacity) {
+    auto it = entries_.end();
+    while (entries_.size() > capacity && it != entries_.begin()) {
+      --it;
+      if (it->pinned) {
+        continue;
+      }
+      index_.erase(std::string_view(it->sql));
+      release(*it);
+      it = entries_.erase(it);
+      ++stats_.evictions;
+    }
+  }
+
+  void purge_detached() {
+    for (auto it = detached_.begin(); it != detached_.end();) {
+      if (it->pinned) {
+        ++it;
+      } else {
+        release(*it);
+        it = detached_.erase(it);
+      }
+    }
+  }
+
+  static void release(Entry& entry) {
+    // An unreset statement reports its last error from sqlite3_finalize.
+    sqlite3_reset(entry.stmt.get());
+    entry.stmt = StatementHandle();
+  }
+
+  size_t capacity_;
+  Entries entries_;   // most recently used first
+  Entries detached_;  // cleared while pinned
+  std::unordered_map<std::string_view, Entries::iterator> index_;
+  StatementCacheStats stats_;
+};
+
+// Retry policy for SQLITE_BUSY: sleeps with exponential backoff and jitter
+// until `deadline` has passed since the first busy event of an operation.
+struct BusyBackoff {
+  std::chrono::milliseconds deadline = std::chrono::milliseconds(5000);
+  std::chrono::microseconds initial_delay = std::chrono::microseconds(100);
+  std::chrono::microseconds max_delay = std::chrono::microseconds(50000);
+};
+
+struct BusyStats {
+  uint64_t busy_events = 0;  // operations that hit a lock
+  uint64_t retries = 0;
+  uint64_t give_ups = 0;  // operations that failed with SQLITE_BUSY
+  double wait_seconds = 0;
+};
+
+// Lives behind a pointer so that SQLite keeps a stable address while the
+// owning Sqlite is moved. Counters may be read from any thread.
+class BusyHandler {
+ public:
+  explicit BusyHandler(const BusyBackoff& backoff)
+      : backoff_(backoff),
+        random_(static_cast<unsigned>(
+            std::chrono::steady_clock::now().time_since_epoch().count())) {}
+
+  static int callback(void* p, int count) {
+    return static_cast<BusyHandler*>(p)->retry(count);
+  }
+
+  BusyStats stats() const {
+    BusyStats stats;
+    stats.busy_events = busy_events_;
+    stats.retries = retries_;
+    stats.give_ups = give_ups_;
+    stats.wait_seconds = wait_nanoseconds_ / 1e9;
+    return stats;
+  }
+
+ private:
+  int retry(int count) {
+    auto now = std::chrono::steady_clock::now();
+    if (count == 0) {
+      busy_events_++;
+      started_ = now;
+    }
+    auto left = backoff_.deadline - (now - started_);
+    if (left <= std::chrono::steady_clock::duration::zero()) {
+      give_ups_++;
+      return 0;
+    }
+
+    auto delay = backoff_.max_delay;
+    if (count < 30) {
+      delay = std::min(backoff_.initial_delay * (int64_t(1) << count),
+                       backoff_.max_delay);
+    }
+    std::uniform_int_distribution<int64_t> jitter(delay.count() / 2,
+                                                  delay.count());
+    auto sleep = std::min<std::chrono::steady_clock::duration>(
+        std::chrono::microseconds(jitter(random_)), left);
+    std::this_thread::sleep_for(sleep);
+
+    retries_++;
+    wait_nanoseconds_ +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - now)
+            .count();
+    return 1;
+  }
+
+  BusyBackoff backoff_;
+  std::minstd_rand random_;
+  std::chrono::steady_clock::time_point started_;
+  std::atomic<uint64_t> busy_events_{0};
+  std::atomic<uint64_t> retries_{0};
+  std::atomic<uint64_t> give_ups_{0};
+  std::atomic<int64_t> wait_nanoseconds_{0};
+};
+
+// Open flags and pragmas applied when a connection is opened. Pragmas run
+// in the order they were first set, except that page_size goes first as it
+// cannot change once the database is in WAL mode.
+class ConnectionOptions {
+ public:
+  ConnectionOptions() : flags_(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) {}
+
+  // Loads quickly at the cost of durability: a crash may lose the load.
+  static ConnectionOptions bulk_load() {
+    return ConnectionOptions()
+        .no_mutex()
+        .journal_mode("MEMORY")
+        .synchronous("OFF")
+        .locking_mode("EXCLUSIVE")
+        .temp_store("MEMORY")
+        .cache_size(-256 * 1024);
+  }
+
+  // Many readers next to an occasional writer.
+  static ConnectionOptions read_mostly() {
+    return ConnectionOptions()
+        .no_mutex()
+        .journal_mode("WAL")
+        .synchronous("NORMAL")
+        .mmap_size(256 * 1024 * 1024)
+        .cache_size(-64 * 1024)
+        .temp_store("MEMORY")
+        .busy_timeout(5000);
+  }
+
+  static ConnectionOptions low_memory() {
+    return ConnectionOptions()
+        .no_mutex()
+        .cache_size(-512)
+        .mmap_size(0)
+        .temp_store("FILE");
+  }
+
+  ConnectionOptions& read_only() {
+    flags_ = (flags_ & ~(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) |
+             SQLITE_OPEN_READONLY;
+    return *this;
+  }
+
+  ConnectionOptions& read_write(bool create = true) {
+    flags_ = (flags_ & ~(SQLITE_OPEN_READONLY | SQLITE_OPEN_CREATE)) |
+             SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+    return *this;
+  }
+
+  ConnectionOptions& uri(bool on = true) {
+    return set_flag(SQLITE_OPEN_URI, on);
+  }
+
+  // Only safe while the connection is used by one thread at a time.
+  ConnectionOptions& no_mutex() {
+    flags_ &= ~SQLITE_OPEN_FULLMUTEX;
+    return set_flag(SQLITE_OPEN_NOMUTEX, true);
+  }
+
+  ConnectionOptions& full_mutex() {
+    flags_ &= ~SQLITE_OPEN_NOMUTEX;
+    return set_flag(SQLITE_OPEN_FULLMUTEX, true);
+  }
+
+  ConnectionOptions& flags(int flags) {
+    flags_ = flags;
+    return *this;
+  }
+
+  ConnectionOptions& vfs(std::string name) {
+    vfs_ = std::move(name);
+    return *this;
+  }
+
+  ConnectionOptions& journal_mode(std::string mode) {
+    return pragma("journal_mode", std::move(mode));
+  }
+
+  ConnectionOptions& synchronous(std::string mode) {
+    return pragma("synchronous", std::move(mode));
+  }
+
+  ConnectionOptions& locking_mode(std::string mode) {
+    return pragma("locking_mode", std::move(mode));
+  }
+
+  ConnectionOptions& temp_store(std::string mode) {
+    return pragma("temp_store", std::move(mode));
+  }
+
+  ConnectionOptions& mmap_size(int64_t bytes) {
+    return pragma("mmap_size", std::to_string(bytes));
+  }
+
+  // Negative values are in KiB, positive values in pages.
+  ConnectionOptions& cache_size(int64_t size) {
+    return pragma("cache_size", std::to_string(size));
+  }
+
+  ConnectionOptions& page_size(int bytes) {
+    return pragma("page_size", std::to_string(bytes));
+  }
+
+  ConnectionOptions& busy_timeout(int milliseconds) {
+    return pragma("busy_timeout", std::to_string(milliseconds));
+  }
+
+  // Replaces busy_timeout, which would otherwise uninstall the handler.
+  ConnectionOptions& busy_backoff(const BusyBackoff& backoff) {
+    busy_backoff_ = backoff;
+    return *this;
+  }
+
+  ConnectionOptions& pragma(std::string name, std::string value) {
+    for (auto& pragma : pragmas_) {
+      if (pragma.first == name) {
+        pragma.second = std::move(value);
+        return *this;
+      }
+    }
+    auto pos = name == "page_size" ? pragmas_.begin() : pragmas_.end();
+    pragmas_.emplace(pos, std::move(name), std::move(value));
+    return *this;
+  }
+
+  int flags() const { return flags_; }
+
+  const char* vfs() const { return vfs_.empty() ? nullptr : vfs_.c_str(); }
+
+  const std::vector<std::pair<std::string, std::string>>& pragmas() const {
+    return pragmas_;
+  }
+
+  const std::optional<BusyBackoff>& busy_backoff() const {
+    return busy_backoff_;
+  }
+
+ private:
+  ConnectionOptions& set_flag(int flag, bool on) {
+    flags_ = on ? flags_ | flag : flags_ & ~flag;
+    return *this;
+  }
+
+  int flags_;
+  std::string vfs_;
+  std::vector<std::pair<std::string, std::string>> pragmas_;
+  std::optional<BusyBackoff> busy_backoff_;
+};
+
+// Inclusive key range handled by one partition of a parallel scan
+struct KeyRange {
+  int64_t first;
+  int64_t last;
+};
+
+namespace {
+
+// Splits [first, last] into at most `partitions` contiguous, non-empty ranges
+// whose sizes differ by at most one.
+inline std::vector<KeyRange> split_key_range(int64_t first, int64_t last,
+                                             size_t partitions) {
+  std::vector<KeyRange> ranges;
+  if (first > last || partitions == 0) {
+    return ranges;
+  }
+  auto span = static_cast<uint64_t>(last) - static_cast<uint64_t>(first);
+  uint64_t n = partitions;
+  if (span < n - 1) {
+    n = span + 1;
+  }
+  auto quotient = span / n;
+  auto remainder = span % n;
+  auto begin = static_cast<uint64_t>(first);
+  for (uint64_t i = 0; i < n; i++) {
+    auto size = quotient + (i <= remainder ? 1 : 0);
+    ranges.push_back({static_cast<int64_t>(begin),
+                      static_cast<int64_t>(begin + size - 1)});
+    begin += size;
+  }
+  return ranges;
+}
+
+inline size_t hardware_threads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+}  // namespace
+
+class Sqlite {
+ public:
+  Sqlite() = delete;
+  Sqlite(const Sqlite&) = delete;
+  Sqlite& operator=(const Sqlite&) = delete;
+
+  static const size_t DefaultStatementCacheCapacity = 16;
+
+  Sqlite(const char* path)
+      : db_(nullptr), cache_(DefaultStatementCacheCapacity) {
+    auto rc = sqlite3_open(path, &db_);
+    if (rc) {
+      sqlite3_close(db_);
+      db_ = nullptr;
+    }
+  }
+
+  Sqlite(const char* path, int flags)
+      : db_(nullptr), cache_(DefaultStatementCacheCapacity) {
+    auto rc = sqlite3_open_v2(path, &db_, flags, nullptr);
+    if (rc) {
+      sqlite3_close(db_);
+      db_ = nullptr;
+    }
+  }
+
+  // Leaves the connection closed if a pragma fails.
+  Sqlite(const char* path, const ConnectionOptions& options)
+      : db_(nullptr), cache_(DefaultStatementCacheCapacity) {
+    auto rc = sqlite3_open_v2(path, &db_, options.flags(), options.vfs());
+    if (rc == SQLITE_OK) {
+      SQLITELIB_TRY {
+        for (const auto& pragma : options.pragmas()) {
+          run_pragma(pragma.first, pragma.second);
+        }
+        if (options.busy_backoff()) {
+          set_busy_backoff(*options.busy_backoff());
+        }
+      } SQLITELIB_CATCH_ALL {
+        rc = SQLITE_ERROR;
+      }
+    }
     if (rc) {
       sqlite3_close(db_);
       db_ = nullptr;
     }
   }
 
-  Sqlite(Sqlite&& rhs) : db_(rhs.db_) {}
+  Sqlite(Sqlite&& rhs)
+      : db_(rhs.db_),
+        cache_(std::move(rhs.cache_)),
+        slots_(std::move(rhs.slots_)),
+        busy_(std::move(rhs.busy_)),
+        control_(std::move(rhs.control_)) {
+    rhs.db_ = nullptr;
+  }
+
+  ~Sqlite() {
+    cache_.clear();
+    for (auto& slot : slots_) {
+      if (slot && slot->stmt) {
+        sqlite3_reset(slot->stmt.get());
+      }
+    }
+    slots_.clear();
+    control_.reset();
+    if (db_) {
+      sqlite3_close(db_);
+    }
+  }
+
+  bool is_open() const { return db_ != nullptr; }
+
+  Statement<void> prepare(const char* query) const {
+    return Statement<void>(db_, query, &transaction_control());
+  }
+
+  template <typename... Types>
+  Statement<Types...> prepare(const char* query) const {
+    return Statement<Types...>(db_, query, &transaction_control());
+  }
+
+  BatchInserter prepare_insert(
+      const char* table, const std::vector<std::string>& columns,
+      size_t max_rows_per_statement =
+          BatchInserter::DefaultMaxRowsPerStatement) const {
+    return BatchInserter(db_, table, columns, max_rows_per_statement,
+                         &transaction_control());
+  }
+
+  template <typename... Args>
+  void execute(const char* query, const Args&... args) {
+    auto stmt = cache_.get(db_, query);
+    StatementResetter resetter(stmt.get());
+    Statement<void>(StatementHandle::borrow(stmt.get())).execute(args...);
+  }
+
+  template <
+      typename T, typename... Rest,
+      typename std::enable_if<!std::is_same<T, void>::value>::type*& = enabler,
+      typename... Args>
+  std::vector<typename ValueType<!sizeof...(Rest), T, Rest...>::type> execute(
+      const char* query, const Args&... args) {
+    auto stmt = cache_.get(db_, query);
+    return Statement<T, Rest...>(StatementHandle::borrow(stmt.get()))
+        .execute(args...);
+  }
+
+  template <typename T, typename... Rest, typename... Args>
+  typename ColumnsType<!sizeof...(Rest), T, Rest...>::type execute_columns(
+      const char* query, const Args&... args) {
+    auto stmt = cache_.get(db_, query);
+    return Statement<T, Rest...>(StatementHandle::borrow(stmt.get()))
+        .execute_columns(args...);
+  }
+
+  template <typename T, typename... Args>
+  T execute_value(const char* query, const Args&... args) {
+    auto stmt = cache_.get(db_, query);
+    return Statement<T>(StatementHandle::borrow(stmt.get()))
+        .execute_value(args...);
+  }
+
+  template <typename... Args>
+  Result<void> try_execute(const char* query, const Args&... args) {
+    auto rc = SQLITE_OK;
+    auto stmt = cache_.get(db_, query, rc);
+    if (rc != SQLITE_OK) {
+      return make_error(db_, rc);
+    }
+    return Statement<void>(std::move(stmt)).try_execute(args...);
+  }
+
+  template <
+      typename T, typename... Rest,
+      typename std::enable_if<!std::is_same<T, void>::value>::type*& = enabler,
+      typename... Args>
+  Result<std::vector<typename ValueType<!sizeof...(Rest), T, Rest...>::type>>
+  try_execute(const char* query, const Args&... args) {
+    auto rc = SQLITE_OK;
+    auto stmt = cache_.get(db_, query, rc);
+    if (rc != SQLITE_OK) {
+      return make_error(db_, rc);
+    }
+    return Statement<T, Rest...>(std::move(stmt)).try_execute(args...);
+  }
+
+  template <typename T, typename... Args>
+  Result<T> try_execute_value(const char* query, const Args&... args) {
+    auto rc = SQLITE_OK;
+    auto stmt = cache_.get(db_, query, rc);
+    if (rc != SQLITE_OK) {
+      return make_error(db_, rc);
+    }
+    return Statement<T>(std::move(stmt)).try_execute_value(args...);
+  }
+
+  template <typename T, typename... Rest, typename... Args>
+  Cursor<T, Rest...> execute_cursor(const char* query, Args&&... args) {
+    auto stmt = cache_.get(db_, query);
+    return Statement<T, Rest...>(std::move(stmt)).execute_cursor(
+        std::forward<Args>(args)...);
+  }
+
+  template <typename T, typename... Rest, typename... Args>
+  PrefetchCursor<T, Rest...> execute_prefetch(const char* query, size_t depth,
+                                              Args&&... args) {
+    auto stmt = cache_.get(db_, query);
+    return Statement<T, Rest...>(std::move(stmt)).execute_prefetch(
+        depth, std::forward<Args>(args)...);
+  }
+
+  // Parallel scans split the `key` range of `table` into partitions and run
+  // `query` once per partition on read-only connections to the same file.
+  // The query receives the inclusive partition bounds as its two parameters:
+  //
+  //   "SELECT name, age FROM people WHERE rowid BETWEEN ? AND ?"
+  //
+  // `partitions` defaults to the number of hardware threads. Each partition
+  // reads its own snapshot, so writes committed during the scan may be seen
+  // by some partitions only; uncommitted changes of this connection are not
+  // seen at all. The database should be in WAL mode for scans to run
+  // alongside a writer.
+
+  // Calls `fn` with every row, concurrently from the worker threads.
+  template <typename T, typename... Rest, typename Fn>
+  void parallel_scan(const char* table, const char* query, Fn fn,
+                     size_t partitions = 0, const char* key = "rowid") {
+    scan_partitions<T, Rest...>(
+        query, key_ranges(table, key, partitions),
+        [&](size_t, Cursor<T, Rest...>& cursor) {
+          for (const auto& row : cursor) {
+            fn(row);
+          }
+        });
+  }
+
+  // Folds each partition with `fold(acc, row)` starting from a
+  // value-initialized Acc, then combines `init` and the partial results in
+  // key order with `combine(acc, partial)`, so `init` is counted once.
+  template <typename T, typename... Rest, typename Acc, typename Fold,
+            typename Combine>
+  Acc parallel_reduce(const char* table, const char* query, Acc init,
+                      Fold fold, Combine combine, size_t partitions = 0,
+                      const char* key = "rowid") {
+    auto ranges = key_ranges(table, key, partitions);
+    std::vector<std::optional<Acc>> partials(ranges.size());
+    scan_partitions<T, Rest...>(
+        query, ranges, [&](size_t i, Cursor<T, Rest...>& cursor) {
+          auto acc = Acc();
+          for (const auto& row : cursor) {
+            acc = fold(std::move(acc), row);
+          }
+          partials[i] = std::move(acc);
+        });
+    for (auto& partial : partials) {
+      init = combine(std::move(init), std::move(*partial));
+    }
+    return init;
+  }
+
+  // Returns the rows of all partitions concatenated in key order.
+  template <typename T, typename... Rest>
+  std::vector<typename ValueType<!sizeof...(Rest), T, Rest...>::type>
+  parallel_execute(const char* table, const char* query,
+                   size_t partitions = 0, const char* key = "rowid") {
+    static_assert(!AnyBorrowed<T, Rest...>::value,
+                  "views are only valid inside a cursor loop");
+    using Rows =
+        std::vector<typename ValueType<!sizeof...(Rest), T, Rest...>::type>;
+    return parallel_reduce<T, Rest...>(
+        table, query, Rows(),
+        [](Rows rows, const typename Rows::value_type& row) {
+          rows.push_back(row);
+          return rows;
+        },
+        [](Rows rows, Rows partial) {
+          if (rows.empty()) {
+            return partial;
+          }
+          rows.insert(rows.end(), std::make_move_iterator(partial.begin()),
+                      std::make_move_iterator(partial.end()));
+          return rows;
+        },
+        partitions, key);
+  }
+
+  size_t statement_cache_capacity() const { return cache_.capacity(); }
+
+  void set_statement_cache_capacity(size_t capacity) {
+    cache_.set_capacity(capacity);
+  }
+
+  size_t statement_cache_size() const { return cache_.size(); }
+
+  const StatementCacheStats& statement_cache_stats() const {
+    return cache_.stats();
+  }
+
+  void clear_statement_cache() { cache_.clear(); }
+
+  // RAII guards over statements prepared once per connection:
+  //
+  //   auto tx = db.transaction(TransactionMode::Immediate);
+  //   ...
+  //   tx.commit();  // rolled back on scope exit otherwise
+  Transaction transaction(TransactionMode mode = TransactionMode::Deferred);
+  Savepoint savepoint();
+
+  // Installs a sqlite3_busy_handler retrying with `backoff`.
+  void set_busy_backoff(const BusyBackoff& backoff) {
+    std::unique_ptr<BusyHandler> handler(new BusyHandler(backoff));
+    verify(db_,
+           sqlite3_busy_handler(db_, BusyHandler::callback, handler.get()));
+    busy_ = std::move(handler);
+  }
+
+  // Counters of the handler installed by set_busy_backoff
+  BusyStats busy_stats() const { return busy_ ? busy_->stats() : BusyStats(); }
+
+  // SQL of the statements that are mid-iteration and so keep a read
+  // transaction (and in WAL mode, a snapshot) open.
+  std::vector<std::string> busy_statements() const {
+    std::vector<std::string> queries;
+    for (auto stmt = sqlite3_next_stmt(db_, nullptr); stmt;
+         stmt = sqlite3_next_stmt(db_, stmt)) {
+      if (sqlite3_stmt_busy(stmt)) {
+        queries.emplace_back(sqlite3_sql(stmt));
+      }
+    }
+    return queries;
+  }
+
+  // Prepares `query` into the statement cache ahead of the first flat call.
+  void warm_statement(const char* query) { cache_.get(db_, query); }
+
+#if __cplusplus >= 202002L
+  template <fixed_string Sql, typename T = void, typename... Rest>
+  Statement<T, Rest...> stmt() {
+    auto index = StatementSlot<Sql>::index();
+    if (index >= slots_.size()) {
+      slots_.resize(index + 1);
+    }
+    if (!slots_[index]) {
+      slots_[index].reset(new Slot());
+    }
+    auto& slot = *slots_[index];
+    if (!slot.stmt) {
+      slot.stmt = StatementHandle(
+          new_sqlite3_stmt(db_, Sql.value, SQLITE_PREPARE_PERSISTENT));
+    } else if (slot.pinned) {
+      // Still used by a live Statement or Cursor, as in nested loops
+      return Statement<T, Rest...>(db_, Sql.value, &transaction_control());
+    } else {
+      sqlite3_reset(slot.stmt.get());
+      sqlite3_clear_bindings(slot.stmt.get());
+    }
+    return Statement<T, Rest...>(
+        StatementHandle::borrow(slot.stmt.get(), &slot.pinned),
+        &transaction_control());
+  }
+#endif
+
+ private:
+  friend class Transaction;
+  friend class Savepoint;
+
+  // Shared by the statements and inserters prepared on this connection
+  TransactionControl& transaction_control() const {
+    if (!control_) {
+      control_.reset(new TransactionControl(db_));
+    }
+    return *control_;
+  }
+
+  void run_pragma(const std::string& name, const std::string& value) {
+    auto query = "PRAGMA " + name + " = " + value;
+    auto stmt = prepare<std::string>(query.c_str());
+    for (const auto& row : stmt.execute_cursor()) {
+      (void)row;
+    }
+  }
+
+  std::vector<KeyRange> key_ranges(const char* table, const char* key,
+                                   size_t partitions) const {
+    auto query = std::string("SELECT MIN(") + key + "), MAX(" + key +
+                 ") FROM " + table;
+    auto bounds = Statement<std::optional<int64_t>, std::optional<int64_t>>(
+                      db_, query.c_str())
+                      .execute();
+    auto first = std::get<0>(bounds[0]);
+    auto last = std::get<1>(bounds[0]);
+    if (!first || !last) {
+      return std::vector<KeyRange>();
+    }
+    return split_key_range(*first, *last,
+                           partitions ? partitions : hardware_threads());
+  }
+
+  // Hands out partitions to up to one worker per hardware thread. Each worker
+  // opens its own read-only connection and prepares `query` once. The first
+  // exception thrown by a worker stops the others and is rethrown here.
+  template <typename T, typename... Rest, typename Fn>
+  void scan_partitions(const char* query, const std::vector<KeyRange>& ranges,
+                       Fn fn) const {
+    if (ranges.empty()) {
+      return;
+    }
+    auto path = sqlite3_db_filename(db_, "main");
+    if (!path || !*path) {
+      SQLITELIB_THROW(
+          std::invalid_argument("parallel scans need a database file"));
+    }
+
+    auto workers = std::min(ranges.size(), hardware_threads());
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::exception_ptr> errors(workers);
+
+    auto work = [&](size_t worker) {
+      SQLITELIB_TRY {
+        Sqlite reader(path, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+        if (!reader.is_open()) {
+          verify(SQLITE_CANTOPEN);
+        }
+        auto stmt = reader.prepare<T, Rest...>(query);
+        for (auto i = next++; i < ranges.size() && !failed; i = next++) {
+          auto cursor = stmt.execute_cursor(ranges[i].first, ranges[i].last);
+          fn(i, cursor);
+        }
+      } SQLITELIB_CATCH_ALL {
+        errors[worker] = std::current_exception();
+        failed = true;
+      }
+    };
+
+    std::vector<std::thread> threads;
+    SQLITELIB_TRY {
+      for (size_t worker = 1; worker < workers; worker++) {
+        threads.emplace_back(work, worker);
+      }
+    } SQLITELIB_CATCH_ALL {
+      failed = true;
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      SQLITELIB_RETHROW;
+    }
+    work(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    for (auto& error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+  }
+
+  // Statements of db.stmt<...>(), pinned like the cache entries while they
+  // are lent out. The table is indexed by slot; each slot lives on the heap
+  // so that its pin stays in place as the table grows.
+  struct Slot {
+    StatementHandle stmt;
+    bool pinned = false;
+  };
+
+  sqlite3* db_;
+  StatementCache cache_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::unique_ptr<BusyHandler> busy_;
+  mutable std::unique_ptr<TransactionControl> control_;
+};
+
+inline Transaction::Transaction(Sqlite& db, TransactionMode mode)
+    : Transaction(db.transaction_control(), mode) {}
+
+inline Savepoint::Savepoint(Sqlite& db) : Savepoint(db.transaction_control()) {}
+
+inline Transaction Sqlite::transaction(TransactionMode mode) {
+  return Transaction(*this, mode);
+}
+
+inline Savepoint Sqlite::savepoint() { return Savepoint(*this); }
+
+struct ConnectionPoolConfig {
+  size_t readers = 0;  // 0: one per hardware thread
+  std::vector<std::string> pragmas;  // run on every connection
+  std::vector<std::string> reader_statements;
+  std::vector<std::string> writer_statements;
+};
+
+struct ConnectionPoolStats {
+  size_t readers = 0;
+  size_t readers_in_use = 0;
+  bool writer_in_use = false;
+  uint64_t reader_acquisitions = 0;
+  uint64_t writer_acquisitions = 0;
+  uint64_t reader_waits = 0;  // acquisitions that found no idle connection
+  uint64_t writer_waits = 0;
+  double reader_wait_seconds = 0;
+  double writer_wait_seconds = 0;
+  double reader_busy_seconds = 0;
+  double writer_busy_seconds = 0;
+  double seconds = 0;  // since the pool was opened
+
+  double reader_utilization() const {
+    return seconds > 0 && readers ? reader_busy_seconds / (seconds * readers)
+                                  : 0;
+  }
+
+  double writer_utilization() const {
+    return seconds > 0 ? writer_busy_seconds / seconds : 0;
+  }
+};
+
+// One writer and N read-only connections to a WAL database. Readers and the
+// writer are handed out from separate queues, so reads never wait for a
+// write to finish. The pool must outlive its leases.
+class ConnectionPool {
+  struct Side {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<Sqlite>> connections;
+    std::vector<Sqlite*> idle;
+    uint64_t acquisitions = 0;
+    uint64_t waits = 0;
+    double wait_seconds = 0;
+    double busy_seconds = 0;
+  };
+
+ public:
+  class Lease {
+   public:
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    Lease(Lease&& rhs)
+        : side_(rhs.side_), db_(rhs.db_), acquired_(rhs.acquired_) {
+      rhs.side_ = nullptr;
+    }
+
+    ~Lease() {
+      if (side_) {
+        ConnectionPool::release(*side_, db_, acquired_);
+      }
+    }
+
+    Sqlite& operator*() const { return *db_; }
+    Sqlite* operator->() const { return db_; }
+
+   private:
+    friend class ConnectionPool;
+
+    Lease(Side* side, Sqlite* db,
+          std::chrono::steady_clock::time_point acquired)
+        : side_(side), db_(db), acquired_(acquired) {}
+
+    Side* side_;
+    Sqlite* db_;
+    std::chrono::steady_clock::time_point acquired_;
+  };
+
+  ConnectionPool(const ConnectionPool&) = delete;
+  ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+  explicit ConnectionPool(
+      const char* path,
+      const ConnectionPoolConfig& config = ConnectionPoolConfig())
+      : opened_(std::chrono::steady_clock::now()) {
+    auto writer = open(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    auto mode = writer->prepare<std::string>("PRAGMA journal_mode=WAL")
+                    .execute_value();
+    if (mode != "wal") {
+      SQLITELIB_THROW(
+          std::invalid_argument("connection pools need a WAL database"));
+    }
+    warm(*writer, config.pragmas, config.writer_statements);
+    writer_.idle.push_back(writer.get());
+    writer_.connections.push_back(std::move(writer));
+
+    auto readers = config.readers ? config.readers : hardware_threads();
+    for (size_t i = 0; i < readers; i++) {
+      auto reader = open(path, SQLITE_OPEN_READONLY);
+      warm(*reader, config.pragmas, config.reader_statements);
+      readers_.idle.push_back(reader.get());
+      readers_.connections.push_back(std::move(reader));
+    }
+  }
+
+  ~ConnectionPool() {
+    assert(readers_.idle.size() == readers_.connections.size());
+    assert(writer_.idle.size() == writer_.connections.size());
+  }
 
-  ~Sqlite() {
-    if (db_) {
-      sqlite3_close(db_);
+  Lease reader() { return acquire(readers_); }
+
+  Lease writer() { return acquire(writer_); }
+
+  size_t readers() const { return readers_.connections.size(); }
+
+  ConnectionPoolStats stats() {
+    ConnectionPoolStats stats;
+    {
+      std::lock_guard<std::mutex> lock(readers_.mutex);
+      stats.readers = readers_.connections.size();
+      stats.readers_in_use = stats.readers - readers_.idle.size();
+      stats.reader_acquisitions = readers_.acquisitions;
+      stats.reader_waits = readers_.waits;
+      stats.reader_wait_seconds = readers_.wait_seconds;
+      stats.reader_busy_seconds = readers_.busy_seconds;
     }
+    {
+      std::lock_guard<std::mutex> lock(writer_.mutex);
+      stats.writer_in_use = writer_.idle.empty();
+      stats.writer_acquisitions = writer_.acquisitions;
+      stats.writer_waits = writer_.waits;
+      stats.writer_wait_seconds = writer_.wait_seconds;
+      stats.writer_busy_seconds = writer_.busy_seconds;
+    }
+    stats.seconds = seconds_since(opened_);
+    return stats;
   }
 
-  bool is_open() const { return db_ != nullptr; }
+ private:
+  static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
 
-  Statement<void> prepare(const char* query) const {
-    return Statement<void>(db_, query);
+  static std::unique_ptr<Sqlite> open(const char* path, int flags) {
+    std::unique_ptr<Sqlite> db(new Sqlite(path, flags | SQLITE_OPEN_NOMUTEX));
+    if (!db->is_open()) {
+      verify(SQLITE_CANTOPEN);
+    }
+    return db;
   }
 
-  template <typename... Types>
-  Statement<Types...> prepare(const char* query) const {
-    return Statement<Types...>(db_, query);
+  static void warm(Sqlite& db, const std::vector<std::string>& pragmas,
+                   const std::vector<std::string>& statements) {
+    for (const auto& pragma : pragmas) {
+      for (const auto& row :
+           db.prepare<std::string>(pragma.c_str()).execute_cursor()) {
+        (void)row;
+      }
+    }
+    for (const auto& query : statements) {
+      db.warm_statement(query.c_str());
+    }
+  }
+
+  static Lease acquire(Side& side) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(side.mutex);
+    if (side.idle.empty()) {
+      side.waits++;
+      side.cv.wait(lock, [&] { return !side.idle.empty(); });
+      side.wait_seconds += seconds_since(start);
+    }
+    side.acquisitions++;
+    auto db = side.idle.back();
+    side.idle.pop_back();
+    return Lease(&side, db, std::chrono::steady_clock::now());
+  }
+
+  static void release(Side& side, Sqlite* db,
+                      std::chrono::steady_clock::time_point acquired) {
+    {
+      std::lock_guard<std::mutex> lock(side.mutex);
+      side.busy_seconds += seconds_since(acquired);
+      side.idle.push_back(db);
+    }
+    side.cv.notify_one();
+  }
+
+  std::chrono::steady_clock::time_point opened_;
+  Side writer_;
+  Side readers_;
+};
+
+namespace {
+
+// Arguments of queued writes are copied; C strings are copied as well.
+template <typename Arg>
+struct StoredArg {
+  using Decayed = typename std::decay<Arg>::type;
+  using type = typename std::conditional<
+      std::is_same<Decayed, const char*>::value ||
+          std::is_same<Decayed, char*>::value,
+      std::string, Decayed>::type;
+};
+
+}  // namespace
+
+// Funnels writes from many threads into one connection. Producers push onto
+// a lock-free stack; the writer thread drains it, runs each request inside a
+// savepoint of a shared transaction and commits once per batch. A batch
+// closes when `max_batch` requests ran, when the queue is empty, or, with a
+// non-zero `max_latency`, when that much time passed since it opened. The
+// futures are fulfilled after the commit.
+class GroupCommitWriter {
+  struct Request {
+    explicit Request(std::function<void(Sqlite&)> fn) : fn(std::move(fn)) {}
+
+    std::function<void(Sqlite&)> fn;
+    std::promise<void> done;
+    Request* next = nullptr;
+  };
+
+ public:
+  static const size_t DefaultMaxBatch = 1024;
+
+  GroupCommitWriter(const GroupCommitWriter&) = delete;
+  GroupCommitWriter& operator=(const GroupCommitWriter&) = delete;
+
+  explicit GroupCommitWriter(
+      Sqlite&& db, size_t max_batch = DefaultMaxBatch,
+      std::chrono::microseconds max_latency = std::chrono::microseconds(0))
+      : db_(std::move(db)),
+        max_batch_(std::max<size_t>(max_batch, 1)),
+        max_latency_(max_latency),
+        head_(nullptr),
+        stopping_(false),
+        waiting_(false),
+        thread_([this] { run(); }) {}
+
+  // Runs the remaining requests before returning.
+  ~GroupCommitWriter() {
+    stopping_ = true;
+    wake();
+    thread_.join();
+  }
+
+  std::future<void> submit(std::function<void(Sqlite&)> fn) {
+    auto request = new Request(std::move(fn));
+    auto done = request->done.get_future();
+    auto head = head_.load(std::memory_order_relaxed);
+    do {
+      request->next = head;
+    } while (!head_.compare_exchange_weak(head, request));
+    wake();
+    return done;
   }
 
   template <typename... Args>
-  void execute(const char* query, const Args&... args) {
-    prepare<void>(query).execute(args...);
+  std::future<void> execute(const char* query, Args&&... args) {
+    return submit([query = std::string(query),
+                   values = std::tuple<typename StoredArg<Args>::type...>(
+                       std::forward<Args>(args)...)](Sqlite& db) {
+      std::apply(
+          [&](const auto&... stored) { db.execute(query.c_str(), stored...); },
+          values);
+    });
   }
 
-  template <
-      typename T, typename... Rest,
-      typename std::enable_if<!std::is_same<T, void>::value>::type*& = enabler,
-      typename... Args>
-  std::vector<typename ValueType<!sizeof...(Rest), T, Rest...>::type> execute(
-      const char* query, const Args&... args) {
-    return prepare<T, Rest...>(query).execute(args...);
+  BatchStats stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+  }
+
+ private:
+  void run() {
+    std::deque<Request*> pending;
+    for (;;) {
+      auto stopping = stopping_.load();
+      collect(pending);
+      if (pending.empty()) {
+        if (stopping) {
+          break;
+        }
+        wait(nullptr);
+        continue;
+      }
+      commit_batch(pending);
+    }
+  }
+
+  // Appends the queued requests in submission order.
+  void collect(std::deque<Request*>& pending) {
+    std::vector<Request*> requests;
+    for (auto head = head_.exchange(nullptr); head; head = head->next) {
+      requests.push_back(head);
+    }
+    pending.insert(pending.end(), requests.rbegin(), requests.rend());
+  }
+
+  void commit_batch(std::deque<Request*>& pending) {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + max_latency_;
+    std::vector<std::unique_ptr<Request>> batch;
+
+    std::optional<Transaction> transaction;
+    SQLITELIB_TRY {
+      transaction.emplace(db_, TransactionMode::Immediate);
+    } SQLITELIB_CATCH_ALL {
+      auto error = std::current_exception();
+      for (size_t i = 0; i < max_batch_ && !pending.empty(); i++) {
+        std::unique_ptr<Request> request(pending.front());
+        pending.pop_front();
+        request->done.set_exception(error);
+      }
+      return;
+    }
+
+    // Set when SQLite rolled back the whole transaction, and the requests run
+    // in it with it. The rest go into the next batch.
+    std::exception_ptr error;
+    size_t count = 0;
+    while (count < max_batch_) {
+      if (max_latency_.count() > 0 && count > 0 &&
+          std::chrono::steady_clock::now() >= deadline) {
+        break;
+      }
+      if (pending.empty()) {
+        collect(pending);
+      }
+      if (pending.empty()) {
+        if (max_latency_.count() > 0 && !stopping_ && wait(&deadline)) {
+          continue;
+        }
+        break;
+      }
+      std::unique_ptr<Request> request(pending.front());
+      pending.pop_front();
+      count++;
+      auto failure = run_request(*request);
+      if (!failure) {
+        batch.push_back(std::move(request));
+        continue;
+      }
+      request->done.set_exception(failure);
+      if (transaction->rolled_back()) {
+        error = failure;
+        break;
+      }
+    }
+
+    if (!error) {
+      SQLITELIB_TRY {
+        transaction->commit();
+      } SQLITELIB_CATCH_ALL {
+        error = std::current_exception();
+      }
+    }
+    transaction.reset();
+
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      stats_.rows += error ? 0 : batch.size();
+      stats_.commits++;
+      stats_.seconds += std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    }
+
+    for (auto& request : batch) {
+      if (error) {
+        request->done.set_exception(error);
+      } else {
+        request->done.set_value();
+      }
+    }
+  }
+
+  // A failed request only rolls back its own savepoint, unless SQLite rolls
+  // back the transaction.
+  std::exception_ptr run_request(Request& request) {
+    SQLITELIB_TRY {
+      Savepoint savepoint(db_);
+      request.fn(db_);
+      savepoint.release();
+      return nullptr;
+    } SQLITELIB_CATCH_ALL {
+      return std::current_exception();
+    }
+  }
+
+  // Returns false when the deadline passed without new requests.
+  bool wait(const std::chrono::steady_clock::time_point* deadline) {
+    auto ready = [&] { return head_.load() != nullptr || stopping_; };
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiting_ = true;
+    auto woken = true;
+    if (deadline) {
+      woken = cv_.wait_until(lock, *deadline, ready);
+    } else {
+      cv_.wait(lock, ready);
+    }
+    waiting_ = false;
+    return woken;
+  }
+
+  void wake() {
+    if (waiting_) {
+      { std::lock_guard<std::mutex> lock(mutex_); }
+      cv_.notify_one();
+    }
+  }
+
+  Sqlite db_;
+  size_t max_batch_;
+  std::chrono::microseconds max_latency_;
+  std::atomic<Request*> head_;
+  std::atomic<bool> stopping_;
+  std::atomic<bool> waiting_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  mutable std::mutex stats_mutex_;
+  BatchStats stats_;
+  std::thread thread_;
+};
+
+#if __cplusplus >= 202002L
+// Recycles coroutine frames by size class so that steady-state tasks do not
+// touch the heap. Frames may be freed on another thread than the one that
+// allocated them, hence the lock.
+class FrameAllocator {
+ public:
+  static const size_t Granularity = 64;
+  static const size_t MaxPooledSize = 4096;
+
+  static void* allocate(size_t size) {
+    if (size > MaxPooledSize) {
+      return ::operator new(size);
+    }
+    auto& pool = instance();
+    auto bucket = (size + Granularity - 1) / Granularity;
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex_);
+      auto& free = pool.free_[bucket];
+      if (!free.empty()) {
+        auto p = free.back();
+        free.pop_back();
+        return p;
+      }
+      pool.heap_allocations_++;
+    }
+    return ::operator new(bucket * Granularity);
+  }
+
+  static void deallocate(void* p, size_t size) {
+    if (size > MaxPooledSize) {
+      ::operator delete(p);
+      return;
+    }
+    auto& pool = instance();
+    auto bucket = (size + Granularity - 1) / Granularity;
+    std::lock_guard<std::mutex> lock(pool.mutex_);
+    pool.free_[bucket].push_back(p);
+  }
+
+  // Number of pooled frames that had to come from the heap
+  static size_t heap_allocations() {
+    auto& pool = instance();
+    std::lock_guard<std::mutex> lock(pool.mutex_);
+    return pool.heap_allocations_;
+  }
+
+ private:
+  FrameAllocator() = default;
+
+  ~FrameAllocator() {
+    for (auto& free : free_) {
+      for (auto p : free) {
+        ::operator delete(p);
+      }
+    }
+  }
+
+  static FrameAllocator& instance() {
+    static FrameAllocator pool;
+    return pool;
+  }
+
+  std::mutex mutex_;
+  std::vector<void*> free_[MaxPooledSize / Granularity + 1];
+  size_t heap_allocations_ = 0;
+};
+
+template <typename T = void>
+class Task;
+
+// Lets Task::get block until a top-level task completes.
+struct TaskWaiter {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+};
+
+struct TaskPromiseBase {
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) noexcept {
+      auto& promise = handle.promise();
+      if (promise.continuation) {
+        return promise.continuation;
+      }
+      if (promise.waiter) {
+        std::lock_guard<std::mutex> lock(promise.waiter->mutex);
+        promise.waiter->done = true;
+        promise.waiter->cv.notify_one();
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  static void* operator new(size_t size) {
+    return FrameAllocator::allocate(size);
+  }
+
+  static void operator delete(void* p, size_t size) {
+    FrameAllocator::deallocate(p, size);
+  }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation;
+  TaskWaiter* waiter = nullptr;
+  std::exception_ptr error;
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+  Task<T> get_return_object();
+
+  template <typename U>
+  void return_value(U&& value) {
+    result.emplace(std::forward<U>(value));
+  }
+
+  T take() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return std::move(*result);
+  }
+
+  std::optional<T> result;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+  Task<void> get_return_object();
+
+  void return_void() {}
+
+  void take() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+// Lazily started coroutine. co_await it from another task, or call get() to
+// run it to completion from ordinary code.
+template <typename T>
+class Task {
+ public:
+  using promise_type = TaskPromise<T>;
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  Task(Task&& rhs) : handle_(rhs.handle_) { rhs.handle_ = nullptr; }
+
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  auto operator co_await() {
+    struct Awaiter {
+      bool await_ready() { return false; }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+        handle.promise().continuation = caller;
+        return handle;
+      }
+
+      T await_resume() { return handle.promise().take(); }
+
+      std::coroutine_handle<promise_type> handle;
+    };
+    return Awaiter{handle_};
+  }
+
+  T get() {
+    TaskWaiter waiter;
+    handle_.promise().waiter = &waiter;
+    handle_.resume();
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    waiter.cv.wait(lock, [&] { return waiter.done; });
+    return handle_.promise().take();
+  }
+
+ private:
+  friend struct TaskPromise<T>;
+
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+  return Task<void>(
+      std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// Work item queued on an AsyncSqlite executor. Operations live inside the
+// awaiting coroutine's frame and are linked intrusively, so queueing them
+// does not allocate.
+struct AsyncOperation {
+  virtual void run(Sqlite& db) = 0;
+
+  AsyncOperation* next = nullptr;
+  std::coroutine_handle<> continuation;
+};
+
+template <typename T, typename... Rest>
+class AsyncCursor;
+
+// Runs queries on a connection owned by a dedicated executor thread.
+// Awaiting coroutines are resumed on that thread once their result is ready.
+class AsyncSqlite {
+ public:
+  AsyncSqlite(const AsyncSqlite&) = delete;
+  AsyncSqlite& operator=(const AsyncSqlite&) = delete;
+
+  explicit AsyncSqlite(Sqlite&& db)
+      : db_(std::move(db)), thread_([this] { run(); }) {}
+
+  // Finishes the queued operations before returning.
+  ~AsyncSqlite() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  // `query` is read on the executor, so it has to stay valid until the
+  // operation has been awaited, as a string literal does.
+  template <typename T = void, typename... Rest, typename... Args>
+  auto async_execute(const char* query, Args&&... args) {
+    return make_operation(
+        [query,
+         values = std::tuple<typename StoredArg<Args>::type...>(
+             std::forward<Args>(args)...)](Sqlite& db) {
+          return std::apply(
+              [&](const auto&... stored) {
+                if constexpr (std::is_void<T>::value) {
+                  db.execute(query, stored...);
+                } else {
+                  return db.execute<T, Rest...>(query, stored...);
+                }
+              },
+              values);
+        });
   }
 
   template <typename T, typename... Args>
-  T execute_value(const char* query, const Args&... args) {
-    return prepare<T>(query).execute_value(args...);
+  auto async_execute_value(const char* query, Args&&... args) {
+    return make_operation(
+        [query,
+         values = std::tuple<typename StoredArg<Args>::type...>(
+             std::forward<Args>(args)...)](Sqlite& db) {
+          return std::apply(
+              [&](const auto&... stored) {
+                return db.execute_value<T>(query, stored...);
+              },
+              values);
+        });
+  }
+
+  // Runs `fn(Sqlite&)` on the executor and yields its result.
+  template <typename Fn>
+  auto async_run(Fn fn) {
+    return make_operation(std::move(fn));
   }
 
   template <typename T, typename... Rest, typename... Args>
-  Cursor<T, Rest...> execute_cursor(const char* query, const Args&... args) {
-    return prepare<T, Rest...>(query).execute_cursor(args...);
+  AsyncCursor<T, Rest...> async_cursor(const char* query, Args&&... args);
+
+ private:
+  template <typename Fn>
+  class Operation : public AsyncOperation {
+    using Result = decltype(std::declval<Fn&>()(std::declval<Sqlite&>()));
+    using Stored = typename std::conditional<std::is_void<Result>::value,
+                                             bool, Result>::type;
+
+   public:
+    Operation(AsyncSqlite* executor, Fn fn)
+        : executor_(executor), fn_(std::move(fn)) {}
+
+    bool await_ready() { return false; }
+
+    void await_suspend(std::coroutine_handle<> caller) {
+      continuation = caller;
+      executor_->post(this);
+    }
+
+    Result await_resume() {
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+      if constexpr (std::is_void<Result>::value) {
+        return;
+      } else {
+        return std::move(*result_);
+      }
+    }
+
+    void run(Sqlite& db) override {
+      SQLITELIB_TRY {
+        if constexpr (std::is_void<Result>::value) {
+          fn_(db);
+        } else {
+          result_.emplace(fn_(db));
+        }
+      } SQLITELIB_CATCH_ALL {
+        error_ = std::current_exception();
+      }
+    }
+
+   private:
+    AsyncSqlite* executor_;
+    Fn fn_;
+    std::optional<Stored> result_;
+    std::exception_ptr error_;
+  };
+
+  template <typename Fn>
+  Operation<Fn> make_operation(Fn fn) {
+    return Operation<Fn>(this, std::move(fn));
+  }
+
+  template <typename T, typename... Rest>
+  friend class AsyncCursor;
+
+  void post(AsyncOperation* operation) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      operation->next = nullptr;
+      if (tail_) {
+        tail_->next = operation;
+      } else {
+        head_ = operation;
+      }
+      tail_ = operation;
+    }
+    cv_.notify_one();
+  }
+
+  void run() {
+    for (;;) {
+      AsyncOperation* operation;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return head_ || stopping_; });
+        if (!head_) {
+          return;
+        }
+        operation = head_;
+        head_ = operation->next;
+        if (!head_) {
+          tail_ = nullptr;
+        }
+      }
+      operation->run(db_);
+      operation->continuation.resume();
+    }
+  }
+
+  Sqlite db_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  AsyncOperation* head_ = nullptr;
+  AsyncOperation* tail_ = nullptr;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+// Steps the statement on the executor `batch_rows` rows at a time:
+//
+//   auto cursor = db.async_cursor<std::string, int>("SELECT ...");
+//   while (auto row = co_await cursor.next()) { ... }
+//
+// Awaiting next() only suspends when the buffered rows are used up.
+template <typename T, typename... Rest>
+class AsyncCursor {
+ public:
+  typedef typename ValueType<!sizeof...(Rest), T, Rest...>::type value_type;
+
+  static const size_t DefaultBatchRows = 256;
+
+  AsyncCursor(const AsyncCursor&) = delete;
+  AsyncCursor& operator=(const AsyncCursor&) = delete;
+
+  auto next() {
+    struct Awaiter : AsyncOperation {
+      bool await_ready() {
+        return cursor->index_ < cursor->rows_.size() || cursor->done_;
+      }
+
+      void await_suspend(std::coroutine_handle<> caller) {
+        continuation = caller;
+        cursor->executor_->post(this);
+      }
+
+      std::optional<value_type> await_resume() {
+        if (cursor->error_) {
+          std::rethrow_exception(std::exchange(cursor->error_, nullptr));
+        }
+        if (cursor->index_ < cursor->rows_.size()) {
+          return std::move(cursor->rows_[cursor->index_++]);
+        }
+        return std::nullopt;
+      }
+
+      void run(Sqlite& db) override { cursor->fill(db); }
+
+      AsyncCursor* cursor;
+    };
+    Awaiter awaiter;
+    awaiter.cursor = this;
+    return awaiter;
   }
 
  private:
-  sqlite3* db_;
+  friend class AsyncSqlite;
+
+  AsyncCursor(AsyncSqlite* executor,
+              std::function<Cursor<T, Rest...>(Sqlite&)> open,
+              size_t batch_rows)
+      : executor_(executor),
+        open_(std::move(open)),
+        batch_rows_(std::max<size_t>(batch_rows, 1)) {
+    static_assert(!AnyBorrowed<T, Rest...>::value,
+                  "views are only valid inside a cursor loop");
+  }
+
+  void fill(Sqlite& db) {
+    rows_.clear();
+    index_ = 0;
+    SQLITELIB_TRY {
+      if (!cursor_) {
+        cursor_.emplace(open_(db));
+        it_ = cursor_->begin();
+      }
+      for (; rows_.size() < batch_rows_ && it_ != cursor_->end(); ++it_) {
+        rows_.push_back(*it_);
+      }
+      done_ = it_ == cursor_->end();
+    } SQLITELIB_CATCH_ALL {
+      error_ = std::current_exception();
+      done_ = true;
+    }
+  }
+
+  AsyncSqlite* executor_;
+  std::function<Cursor<T, Rest...>(Sqlite&)> open_;
+  size_t batch_rows_;
+  std::optional<Cursor<T, Rest...>> cursor_;
+  Iterator<T, Rest...> it_;
+  std::vector<value_type> rows_;
+  size_t index_ = 0;
+  bool done_ = false;
+  std::exception_ptr error_;
 };
 
+template <typename T, typename... Rest, typename... Args>
+AsyncCursor<T, Rest...> AsyncSqlite::async_cursor(const char* query,
+                                                  Args&&... args) {
+  return AsyncCursor<T, Rest...>(
+      this,
+      [query = std::string(query),
+       values = std::tuple<typename StoredArg<Args>::type...>(
+           std::forward<Args>(args)...)](Sqlite& db) {
+        return std::apply(
+            [&](const auto&... stored) {
+              return db.execute_cursor<T, Rest...>(query.c_str(), stored...);
+            },
+            values);
+      },
+      AsyncCursor<T, Rest...>::DefaultBatchRows);
+}
+#endif
+
 }  // namespace sqlitelib
 
 #endif
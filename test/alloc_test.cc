@@ -0,0 +1,307 @@
+#define CATCH_CONFIG_RUNNER
+#include <sqlitelib.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "catch.hpp"
+
+using namespace std;
+using namespace sqlitelib;
+
+// Allocation counts of the hot paths. Global operator new and SQLite's
+// allocator are replaced by counting versions, and each test compares the
+// counters before and after the code under test once it has been warmed up.
+
+namespace {
+
+atomic<size_t> new_count(0);
+atomic<size_t> delete_count(0);
+atomic<size_t> sqlite_count(0);
+
+sqlite3_mem_methods default_methods;
+
+void* counting_malloc(int size) {
+  ++sqlite_count;
+  return default_methods.xMalloc(size);
+}
+
+void* counting_realloc(void* p, int size) {
+  ++sqlite_count;
+  return default_methods.xRealloc(p, size);
+}
+
+void install_counting_sqlite_allocator() {
+  sqlite3_config(SQLITE_CONFIG_GETMALLOC, &default_methods);
+  auto methods = default_methods;
+  methods.xMalloc = counting_malloc;
+  methods.xRealloc = counting_realloc;
+  sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+}
+
+struct Allocations {
+  size_t news;
+  size_t sqlite;
+  size_t deletes;
+};
+
+// Runs `fn` and returns the allocations it made.
+template <typename Fn>
+Allocations count(Fn fn) {
+  auto news = new_count.load();
+  auto sqlite = sqlite_count.load();
+  auto deletes = delete_count.load();
+  fn();
+  return Allocations{new_count - news, sqlite_count - sqlite,
+                     delete_count - deletes};
+}
+
+const int Rows = 1000;
+
+const char* Schema =
+    "CREATE TABLE items (id INTEGER PRIMARY KEY, num INTEGER, name TEXT)";
+
+const char* Populate =
+    "INSERT INTO items (num, name) WITH RECURSIVE seq(i) AS (SELECT 1 UNION "
+    "ALL SELECT i + 1 FROM seq WHERE i < 1000) SELECT i, printf('%032d', i) "
+    "FROM seq";
+
+// SQLite itself allocates a little on every execution, so the wrapper is
+// held to the count of the same execution through the raw C API.
+template <typename Bind>
+size_t raw_sqlite_allocations(sqlite3* db, const char* sql, Bind bind) {
+  sqlite3_stmt* stmt = nullptr;
+  sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+  auto execute = [&] {
+    bind(stmt);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    }
+    sqlite3_reset(stmt);
+  };
+  execute();
+  auto allocations = count(execute).sqlite;
+  sqlite3_finalize(stmt);
+  return allocations;
+}
+
+size_t raw_sqlite_allocations(sqlite3* db, const char* sql) {
+  return raw_sqlite_allocations(db, sql, [](sqlite3_stmt*) {});
+}
+
+#if __cplusplus >= 202002L
+Task<int> sum_lookups(AsyncSqlite& db, int count) {
+  auto sum = 0;
+  for (auto i = 1; i <= count; i++) {
+    sum += co_await db.async_execute_value<int>(
+        "SELECT num FROM items WHERE id=?", i);
+  }
+  co_return sum;
+}
+#endif
+
+}  // namespace
+
+// GCC reports the free() in a replaced operator delete as a mismatch with
+// operator new once it inlines both.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  ++new_count;
+  if (auto p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept {
+  if (p) {
+    ++delete_count;
+  }
+  free(p);
+}
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+int main(int argc, char* argv[]) {
+  install_counting_sqlite_allocator();
+  return Catch::Session().run(argc, argv);
+}
+
+TEST_CASE("Allocations", "[allocation]") {
+  Sqlite db(":memory:");
+  db.execute(Schema);
+  db.execute(Populate);
+
+  sqlite3* raw = nullptr;
+  sqlite3_open(":memory:", &raw);
+  sqlite3_exec(raw, Schema, nullptr, nullptr, nullptr);
+  sqlite3_exec(raw, Populate, nullptr, nullptr, nullptr);
+
+  auto lookup = "SELECT num FROM items WHERE id=?";
+  auto scan = "SELECT num FROM items";
+  auto bind_id = [](sqlite3_stmt* stmt) { sqlite3_bind_int(stmt, 1, 1); };
+
+  SECTION("Iterator over ints allocates nothing") {
+    auto stmt = db.prepare<int>(scan);
+    auto sum = 0;
+    auto iterate = [&] {
+      for (auto num : stmt.execute_cursor()) {
+        sum += num;
+      }
+    };
+    iterate();
+
+    auto allocations = count(iterate);
+    REQUIRE(sum == Rows * (Rows + 1));
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.sqlite == raw_sqlite_allocations(raw, scan));
+  }
+
+  SECTION("Iterator over string_views allocates nothing") {
+    auto names = "SELECT name FROM items";
+    auto stmt = db.prepare<string_view>(names);
+    size_t length = 0;
+    auto iterate = [&] {
+      for (auto name : stmt.execute_cursor()) {
+        length += name.size();
+      }
+    };
+    iterate();
+
+    auto allocations = count(iterate);
+    REQUIRE(length == 2 * Rows * 32);
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.sqlite == raw_sqlite_allocations(raw, names));
+  }
+
+#if __cplusplus >= 202002L
+  SECTION("Iterator over byte spans allocates nothing") {
+    auto blobs = "SELECT CAST(name AS BLOB) FROM items";
+    auto stmt = db.prepare<span<const byte>>(blobs);
+    size_t length = 0;
+    auto iterate = [&] {
+      for (auto blob : stmt.execute_cursor()) {
+        length += blob.size();
+      }
+    };
+    iterate();
+
+    auto allocations = count(iterate);
+    REQUIRE(length == 2 * Rows * 32);
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.sqlite == raw_sqlite_allocations(raw, blobs));
+  }
+#endif
+
+  SECTION("Statement::execute_value allocates nothing after warm-up") {
+    auto stmt = db.prepare<int>(lookup);
+    stmt.execute_value(1);
+
+    auto sum = 0;
+    auto allocations = count([&] {
+      for (auto i = 1; i <= Rows; i++) {
+        sum += stmt.execute_value(i);
+      }
+    });
+    REQUIRE(sum == Rows * (Rows + 1) / 2);
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.sqlite ==
+            Rows * raw_sqlite_allocations(raw, lookup, bind_id));
+  }
+
+  SECTION("bind_values copies nothing") {
+    auto lengths = "SELECT length(?) + length(?) + length(?)";
+    auto stmt = db.prepare<int>(lengths);
+    string text(64, 'x');
+    string_view view(text);
+    stmt.execute_value(text, view, text.c_str());
+
+    auto length = 0;
+    auto allocations = count(
+        [&] { length = stmt.execute_value(text, view, text.c_str()); });
+    REQUIRE(length == 3 * 64);
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.sqlite ==
+            raw_sqlite_allocations(raw, lengths, [&](sqlite3_stmt* raw_stmt) {
+              for (auto col = 1; col <= 3; col++) {
+                sqlite3_bind_text(raw_stmt, col, text.data(),
+                                  static_cast<int>(text.size()),
+                                  SQLITE_STATIC);
+              }
+            }));
+  }
+
+  SECTION("Rebinding a parameter frees the buffer moved into it") {
+    auto stmt = db.prepare<int>("SELECT length(?)");
+    stmt.bind(string(64 * 1024, 'x'));
+    REQUIRE(stmt.execute_value() == 64 * 1024);
+
+    auto small = string("y");
+    auto allocations = count([&] { stmt.bind(small); });
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.deletes == 1);
+    REQUIRE(stmt.execute_value() == 1);
+
+    stmt.bind(string(64 * 1024, 'x'));
+    allocations = count([&] { stmt.execute_value(string_view(small)); });
+    REQUIRE(allocations.deletes == 1);
+  }
+
+  SECTION("Flat API allocates nothing after warm-up") {
+    db.execute_value<int>(lookup, 1);
+    for (auto num : db.execute_cursor<int>(scan)) {
+      (void)num;
+    }
+
+    auto sum = 0;
+    auto allocations = count([&] {
+      for (auto i = 1; i <= Rows; i++) {
+        sum += db.execute_value<int>(lookup, i);
+      }
+      for (auto num : db.execute_cursor<int>(scan)) {
+        sum += num;
+      }
+    });
+    REQUIRE(sum == Rows * (Rows + 1));
+    REQUIRE(allocations.news == 0);
+    REQUIRE(allocations.sqlite ==
+            Rows * raw_sqlite_allocations(raw, lookup, bind_id) +
+                raw_sqlite_allocations(raw, scan));
+  }
+
+  SECTION("Statement::execute moves rows into the result") {
+    auto names = "SELECT name FROM items";
+    auto stmt = db.prepare<string>(names);
+    stmt.execute();
+
+    // One allocation per (non-SSO) string plus the vector's growth
+    size_t size = 0;
+    auto allocations = count([&] { size = stmt.execute().size(); });
+    REQUIRE(size == Rows);
+    REQUIRE(allocations.news <= Rows + 16);
+    REQUIRE(allocations.sqlite == raw_sqlite_allocations(raw, names));
+  }
+
+#if __cplusplus >= 202002L
+  SECTION("Awaiting AsyncSqlite allocates nothing after warm-up") {
+    AsyncSqlite async(std::move(db));
+    sum_lookups(async, 1).get();
+
+    auto sum = 0;
+    auto allocations = count([&] { sum = sum_lookups(async, Rows).get(); });
+    REQUIRE(sum == Rows * (Rows + 1) / 2);
+    REQUIRE(allocations.news == 0);
+  }
+#endif
+
+  sqlite3_close(raw);
+}
@@ -0,0 +1,50 @@
+#define CATCH_CONFIG_MAIN
+#include <sqlitelib.h>
+
+#include "catch.hpp"
+
+using namespace std;
+using namespace sqlitelib;
+
+// Built with exceptions disabled: every failure below has to come back as a
+// value, since anything that would throw aborts the test instead.
+
+#ifndef SQLITELIB_NO_EXCEPTIONS
+#error "this test has to be built without exception support"
+#endif
+
+TEST_CASE("Without exceptions", "[noexcept]") {
+  Sqlite db(":memory:");
+  db.execute("CREATE TABLE t (n INTEGER PRIMARY KEY)");
+
+  SECTION("try_ functions return every failure") {
+    REQUIRE(db.try_execute("INSERT INTO t VALUES (?)", 1));
+
+    auto duplicate = db.try_execute("INSERT INTO t VALUES (?)", 1);
+    REQUIRE(duplicate.error().extended_code == SQLITE_CONSTRAINT_PRIMARYKEY);
+
+    auto missing = db.try_execute("INSERT INTO missing VALUES (1)");
+    REQUIRE(missing.error().code == SQLITE_ERROR);
+    REQUIRE(string(missing.error().message()) == "no such table: missing");
+
+    auto extra = db.try_execute_value<int>("SELECT ?", 1, 2);
+    REQUIRE(extra.error().code == SQLITE_RANGE);
+
+    auto stmt = db.prepare<int>("SELECT n FROM t WHERE n > ?");
+    REQUIRE(stmt.try_execute(0, 1).error().code == SQLITE_RANGE);
+    REQUIRE(*stmt.try_execute(0) == vector<int>{1});
+
+    REQUIRE(*db.try_execute_value<int>("SELECT COUNT(*) FROM t") == 1);
+  }
+
+  SECTION("Destructors survive a rollback done by SQLite") {
+    {
+      auto tx = db.transaction();
+      auto savepoint = db.savepoint();
+      db.execute("INSERT INTO t VALUES (1)");
+      auto rolled_back = db.try_execute("INSERT OR ROLLBACK INTO t VALUES (1)");
+      REQUIRE(rolled_back.error().code == SQLITE_CONSTRAINT);
+    }
+    REQUIRE(*db.try_execute_value<int>("SELECT COUNT(*) FROM t") == 0);
+  }
+}
@@ -1,4 +1,5 @@
 ﻿#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <sqlitelib.h>
 
 #include "catch.hpp"
@@ -6,6 +7,100 @@
 using namespace std;
 using namespace sqlitelib;
 
+struct Person {
+  string name;
+  int age;
+  vector<char> data;
+};
+
+struct Uuid {
+  unsigned char bytes[16];
+};
+
+// Fails to decode negative values
+struct Positive {
+  int value;
+};
+
+namespace sqlitelib {
+
+template <>
+struct type_traits<Uuid> {
+  static int bind(sqlite3_stmt* stmt, int col, const Uuid& val,
+                  sqlite3_destructor_type lifetime) {
+    return sqlite3_bind_blob(stmt, col, val.bytes, sizeof(val.bytes),
+                             lifetime);
+  }
+
+  static Uuid fetch(sqlite3_stmt* stmt, int col) {
+    Uuid val{};
+    if (sqlite3_column_bytes(stmt, col) == sizeof(val.bytes)) {
+      memcpy(val.bytes, sqlite3_column_blob(stmt, col), sizeof(val.bytes));
+    }
+    return val;
+  }
+};
+
+template <>
+struct type_traits<Positive> {
+  static int bind(sqlite3_stmt* stmt, int col, const Positive& val,
+                  sqlite3_destructor_type) {
+    return sqlite3_bind_int(stmt, col, val.value);
+  }
+
+  static Positive fetch(sqlite3_stmt* stmt, int col) {
+    auto value = sqlite3_column_int(stmt, col);
+    if (value < 0) {
+      throw out_of_range("negative");
+    }
+    return Positive{value};
+  }
+};
+
+}  // namespace sqlitelib
+
+#if __cplusplus >= 202002L
+const size_t early_slot = StatementSlot<"SELECT 'early'">::index();
+
+Task<int> sum_ages(AsyncSqlite& db) {
+  auto rows = co_await db.async_execute<string, int>(
+      "SELECT name, age FROM people WHERE age > ?", 0);
+  auto sum = 0;
+  for (const auto& [name, age] : rows) {
+    sum += age;
+  }
+  co_return sum;
+}
+
+Task<long long> sum_numbers(AsyncSqlite& db) {
+  long long sum = 0;
+  auto cursor = db.async_cursor<int>("SELECT n FROM numbers");
+  while (auto n = co_await cursor.next()) {
+    sum += *n;
+  }
+  co_return sum;
+}
+
+Task<void> fill_numbers(AsyncSqlite& db, int count) {
+  co_await db.async_execute("CREATE TEMP TABLE numbers (n INTEGER)");
+  co_await db.async_run([count](Sqlite& db) {
+    auto stmt = db.prepare("INSERT INTO numbers (n) VALUES (?)");
+    for (auto i = 0; i < count; i++) {
+      stmt.execute(i);
+    }
+  });
+}
+
+Task<bool> query_fails(AsyncSqlite& db) {
+  try {
+    co_await db.async_execute_value<int>("SELECT COUNT(*) FROM no_such_table");
+  } catch (...) {
+    co_return true;
+  }
+  co_return false;
+}
+#endif
+
 TEST_CASE("Sqlite Test", "[general]") {
   Sqlite db("./test.db");
   REQUIRE(db.is_open());
@@ -97,6 +192,171 @@ TEST_CASE("Sqlite Test", "[general]") {
     }
   }
 
+  SECTION("BindZeroCopy") {
+    auto insert =
+        db.prepare("INSERT INTO people (name, age, data) VALUES (?, ?, ?)");
+    auto name = string("george");
+    auto blob = vector<char>(1024 * 1024, 'x');
+    insert.execute(string_view(name), 30, blob);
+
+    auto stmt = db.prepare<int>("SELECT age FROM people WHERE name=?");
+    REQUIRE(stmt.execute_value(name) == 30);
+    REQUIRE(stmt.execute_value(string_view("george")) == 30);
+
+    auto sizes =
+        db.execute<int>("SELECT length(data) FROM people WHERE name=?", name);
+    REQUIRE(sizes.size() == 1);
+    REQUIRE(sizes[0] == 1024 * 1024);
+
+#if __cplusplus >= 202002L
+    auto bytes = vector<byte>(16, byte('y'));
+    insert.execute("ringo", 35, span<const byte>(bytes));
+    REQUIRE(db.execute_value<int>(
+                "SELECT length(data) FROM people WHERE name='ringo'") == 16);
+#endif
+
+    // Bindings made by bind() are copied and survive the arguments
+    {
+      auto rows = stmt.bind(string("george")).execute();
+      REQUIRE(rows.size() == 1);
+      REQUIRE(rows[0] == 30);
+    }
+  }
+
+  SECTION("BindOwnership") {
+    auto stmt = db.prepare<int>("SELECT length(?) + instr(?, 'x')");
+
+    // Moved buffers stay bound until they are rebound
+    auto blob = vector<char>(OwnedBufferThreshold, 'x');
+    stmt.bind(std::move(blob), string(OwnedBufferThreshold, 'y') + "x");
+    REQUIRE(stmt.execute_value() == OwnedBufferThreshold + 1025);
+    REQUIRE(stmt.execute_value() == OwnedBufferThreshold + 1025);
+
+    // and move with the statement
+    auto moved = std::move(stmt);
+    REQUIRE(moved.execute_value() == OwnedBufferThreshold + 1025);
+
+    moved.bind(string(2 * OwnedBufferThreshold, 'y'), string("x"));
+    REQUIRE(moved.execute_value() == 2 * OwnedBufferThreshold + 1);
+
+    // Small and lvalue arguments are copied as before
+    auto small = string("z");
+    moved.bind(small, small);
+    REQUIRE(moved.execute_value() == 1);
+
+    // Readers that take over a temporary statement keep its buffers
+    auto big = string(4 * OwnedBufferThreshold, 'x');
+    for (auto length :
+         db.execute_cursor<int>("SELECT length(?)", string(big))) {
+      REQUIRE(length == 4 * OwnedBufferThreshold);
+    }
+    for (auto length : db.prepare<int>("SELECT length(?)")
+                           .execute_cursor(string(big))) {
+      REQUIRE(length == 4 * OwnedBufferThreshold);
+    }
+    for (auto length :
+         db.execute_prefetch<int>("SELECT length(?)", 2, string(big))) {
+      REQUIRE(length == 4 * OwnedBufferThreshold);
+    }
+    auto reader =
+        db.prepare<string>("SELECT ?").execute_arrow(16, string(big));
+    ArrowArray batch;
+    REQUIRE(reader.next(&batch));
+    auto offsets = static_cast<const int64_t*>(batch.children[0]->buffers[1]);
+    REQUIRE(offsets[1] == static_cast<int64_t>(big.size()));
+    batch.release(&batch);
+  }
+
+  SECTION("ExecuteMany") {
+    auto insert = db.prepare("INSERT INTO people (name, age) VALUES (?, ?)");
+
+    vector<tuple<string, int>> rows;
+    for (auto i = 0; i < 100; i++) {
+      rows.emplace_back("user" + to_string(i), 100 + i);
+    }
+
+    auto stats = insert.execute_many(rows, 30);
+    REQUIRE(stats.rows == 100);
+    REQUIRE(stats.commits == 4);
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM people") == 104);
+    REQUIRE(db.execute_value<string>("SELECT name FROM people WHERE age=?",
+                                     199) == "user99");
+
+    // An exact multiple of commit_every runs no empty transaction at the end
+    rows.resize(90);
+    stats = insert.execute_many(rows, 30);
+    REQUIRE(stats.rows == 90);
+    REQUIRE(stats.commits == 3);
+    REQUIRE(insert.execute_many(vector<tuple<string, int>>(), 30).commits ==
+            0);
+
+    // Single values
+    auto ages = db.prepare("UPDATE people SET age=age+1 WHERE age=?");
+    REQUIRE(ages.execute_many(vector<int>{10, 20}).rows == 2);
+    REQUIRE(db.execute_value<int>("SELECT age FROM people WHERE name=?",
+                                  "john") == 11);
+
+    // A failing row rolls back the whole batch
+    db.execute("CREATE TABLE IF NOT EXISTS unique_names (name TEXT UNIQUE)");
+    auto names = db.prepare("INSERT INTO unique_names (name) VALUES (?)");
+    auto single = vector<string>{"a", "b", "a"};
+    CHECK_THROWS_AS(names.execute_many(single), std::exception);
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM unique_names") == 0);
+
+    // Inside an open transaction the rows join it
+    db.execute("BEGIN");
+    names.execute_many(vector<string>{"c", "d"});
+    db.execute("ROLLBACK");
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM unique_names") == 0);
+
+    db.execute("DROP TABLE IF EXISTS unique_names");
+  }
+
+  SECTION("BatchInserter") {
+    auto insert = db.prepare_insert("people", {"name", "age"}, 8);
+    REQUIRE(insert.rows_per_statement() == 8);
+
+    vector<tuple<string, int>> rows;
+    for (auto i = 0; i < 21; i++) {
+      rows.emplace_back("user" + to_string(i), 100 + i);
+    }
+
+    auto stats = insert.execute(rows);
+    REQUIRE(stats.rows == 21);
+    REQUIRE(stats.commits == 1);
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM people") == 25);
+
+    auto names = db.execute<string, int>(
+        "SELECT name, age FROM people WHERE age >= 100 ORDER BY age");
+    REQUIRE(names.size() == 21);
+    REQUIRE(get<0>(names[0]) == "user0");
+    REQUIRE(get<0>(names[20]) == "user20");
+    REQUIRE(get<1>(names[20]) == 120);
+
+    // Never more variables than SQLITE_LIMIT_VARIABLE_NUMBER
+    auto wide = db.prepare_insert("people", {"name", "age"}, 1000000);
+    REQUIRE(wide.rows_per_statement() < 1000000);
+    REQUIRE(wide.execute(rows).rows == 21);
+
+    // Rows must bind exactly the listed columns
+    auto narrow = db.prepare_insert("people", {"name"});
+    REQUIRE_THROWS_AS(narrow.execute(rows), invalid_argument);
+    auto people = db.prepare_insert("people", {"name", "age", "data"});
+    REQUIRE_THROWS_AS(people.execute(rows), invalid_argument);
+    REQUIRE(people.execute(vector<Person>{{"ringo", 80, {}}}).rows == 1);
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM people") == 47);
+
+    // Names are quoted
+    db.execute("CREATE TABLE \"order items\" "
+               "(\"group\" TEXT, \"say \"\"hi\"\"\" INT)");
+    auto quoted = db.prepare_insert("order items", {"group", "say \"hi\""});
+    REQUIRE(quoted.execute(rows).rows == 21);
+    REQUIRE(db.execute_value<int>(
+                "SELECT SUM(\"say \"\"hi\"\"\") FROM \"order items\"") ==
+            2310);
+    db.execute("DROP TABLE \"order items\"");
+  }
+
   SECTION("ReusePreparedStatement") {
     {
       auto stmt = db.prepare<string>("SELECT name FROM people WHERE age>?");
@@ -167,6 +427,991 @@ TEST_CASE("Sqlite Test", "[general]") {
     }
   }
 
+  SECTION("IteratorZeroCopy") {
+    auto stmt = db.prepare<string_view, int>("SELECT name, age FROM people");
+
+    auto itData = data.begin();
+    for (const auto& [name, age] : stmt.execute_cursor()) {
+      REQUIRE(itData->first == name);
+      REQUIRE(itData->second == age);
+      ++itData;
+    }
+    REQUIRE(itData == data.end());
+
+    // A copy may be dereferenced while the cursor stays on its row
+    auto names = db.execute_cursor<string_view>("SELECT name FROM people");
+    auto first = names.begin();
+    auto copy = first;
+    REQUIRE(*copy == "john");
+    REQUIRE(*first == "john");
+    REQUIRE(*++first == "paul");
+
+    // An empty result is not dereferenced in debug builds
+    REQUIRE(db.execute_value<int>("SELECT age FROM people WHERE 0") == 0);
+    REQUIRE(db.prepare<string>("SELECT name FROM people WHERE 0")
+                .execute_value() == "");
+
+#if __cplusplus >= 202002L
+    auto blobs = db.prepare<span<const byte>>("SELECT data FROM people");
+    auto cursor = blobs.execute_cursor();
+    auto it = cursor.begin();
+    REQUIRE((*it).size() == 4);
+    REQUIRE((*it)[0] == byte('A'));
+    REQUIRE((*it)[3] == byte('D'));
+#endif
+  }
+
+  SECTION("ExecuteColumns") {
+    db.execute("INSERT INTO people (name, age) VALUES (NULL, NULL)");
+
+    auto [names, ages, blobs] = db.execute_columns<string, int, vector<char>>(
+        "SELECT name, age, data FROM people ORDER BY id");
+    REQUIRE(names.size() == 5);
+    REQUIRE(ages.size() == 5);
+    REQUIRE(names[0] == "john");
+    REQUIRE(names[3] == "luke");
+    REQUIRE(names.offsets().size() == 6);
+    REQUIRE(names.data().size() == 16);
+    REQUIRE(ages.values() == vector<int>{10, 20, 15, 25, 0});
+    REQUIRE(blobs[1] == "EBGH");
+
+    REQUIRE(!ages.is_null(0));
+    REQUIRE(ages.is_null(4));
+    REQUIRE(names.is_null(4));
+    REQUIRE(blobs.is_null(4));
+    REQUIRE(ages.null_count() == 1);
+    REQUIRE(ages.validity().size() == 1);
+    REQUIRE(ages.validity()[0] == 0x0f);
+
+    auto stmt = db.prepare<double>("SELECT age FROM people WHERE age > ?");
+    auto values = stmt.execute_columns(15);
+    REQUIRE(values.values() == vector<double>{20, 25});
+    REQUIRE(values.null_count() == 0);
+
+    auto adults =
+        db.execute_columns<bool>("SELECT age > 15 FROM people ORDER BY id");
+    REQUIRE(adults.size() == 5);
+    REQUIRE(!adults[0]);
+    REQUIRE(adults[1]);
+    REQUIRE(adults.values() == vector<uint8_t>{0, 1, 0, 1, 0});
+    REQUIRE(adults.is_null(4));
+
+    // A decode that fails mid-result leaves the statement reset
+    auto positives = db.prepare<Positive>(
+        "SELECT CASE WHEN id < 3 THEN id ELSE -1 END FROM people ORDER BY id");
+    REQUIRE_THROWS_AS(positives.execute_columns(), out_of_range);
+    REQUIRE(db.busy_statements().empty());
+  }
+
+  SECTION("ExecuteArrow") {
+    auto stmt = db.prepare<string, int>("SELECT name, age FROM people");
+    auto reader = stmt.execute_arrow(3);
+
+    ArrowSchema schema;
+    reader.get_schema(&schema);
+    REQUIRE(string(schema.format) == "+s");
+    REQUIRE(schema.n_children == 2);
+    REQUIRE(string(schema.children[0]->format) == "U");
+    REQUIRE(string(schema.children[0]->name) == "name");
+    REQUIRE(string(schema.children[1]->format) == "i");
+    schema.release(&schema);
+    REQUIRE(schema.release == nullptr);
+
+    ArrowArray batch;
+    REQUIRE(reader.next(&batch));
+    REQUIRE(batch.length == 3);
+    REQUIRE(batch.n_children == 2);
+    {
+      auto names = batch.children[0];
+      auto offsets = static_cast<const int64_t*>(names->buffers[1]);
+      auto chars = static_cast<const char*>(names->buffers[2]);
+      REQUIRE(names->length == 3);
+      REQUIRE(string(chars + offsets[1], offsets[2] - offsets[1]) == "paul");
+
+      auto ages = static_cast<const int*>(batch.children[1]->buffers[1]);
+      REQUIRE(ages[2] == 15);
+    }
+    batch.release(&batch);
+
+    REQUIRE(reader.next(&batch));
+    REQUIRE(batch.length == 1);
+    batch.release(&batch);
+    REQUIRE(!reader.next(&batch));
+
+    // Types from the declared column types, NULLs in the validity bitmap
+    db.execute("INSERT INTO people (name) VALUES ('nobody')");
+    auto dynamic = db.prepare("SELECT id, name, age, data FROM people");
+    auto dynamic_reader = dynamic.execute_arrow(100);
+    REQUIRE(dynamic_reader.types() ==
+            vector<ArrowType>{ArrowType::Int64, ArrowType::Utf8,
+                              ArrowType::Int64, ArrowType::Binary});
+    REQUIRE(dynamic_reader.next(&batch));
+    REQUIRE(batch.length == 5);
+    auto ages = batch.children[2];
+    REQUIRE(ages->null_count == 1);
+    auto validity = static_cast<const uint8_t*>(ages->buffers[0]);
+    REQUIRE(validity[0] == 0x0f);
+    REQUIRE(static_cast<const int64_t*>(ages->buffers[1])[3] == 25);
+    batch.release(&batch);
+
+    // Native types and optional columns
+    auto natives = db.prepare<optional<int64_t>, float, bool, uint32_t>(
+        "SELECT age, age / 2.0, age > 15, age * 100000000 FROM people "
+        "ORDER BY id");
+    auto native_reader = natives.execute_arrow(100);
+    REQUIRE(native_reader.types() ==
+            vector<ArrowType>{ArrowType::Int64, ArrowType::Float,
+                              ArrowType::Boolean, ArrowType::UInt32});
+    native_reader.get_schema(&schema);
+    REQUIRE(string(schema.children[0]->format) == "l");
+    REQUIRE(string(schema.children[1]->format) == "f");
+    REQUIRE(string(schema.children[2]->format) == "b");
+    REQUIRE(string(schema.children[3]->format) == "I");
+    schema.release(&schema);
+
+    REQUIRE(native_reader.next(&batch));
+    REQUIRE(batch.length == 5);
+    REQUIRE(batch.children[0]->null_count == 1);
+    REQUIRE(static_cast<const int64_t*>(batch.children[0]->buffers[1])[1] ==
+            20);
+    REQUIRE(static_cast<const float*>(batch.children[1]->buffers[1])[0] ==
+            5.0f);
+    // john 10, paul 20, mark 15, luke 25, nobody NULL
+    REQUIRE(static_cast<const uint8_t*>(batch.children[2]->buffers[1])[0] ==
+            0x0a);
+    REQUIRE(static_cast<const uint32_t*>(batch.children[3]->buffers[1])[3] ==
+            2500000000u);
+    batch.release(&batch);
+
+    // Narrow integer columns
+    auto narrow = db.prepare<int8_t, int16_t, uint8_t, uint16_t>(
+        "SELECT -age, age * -1000, age * 10, age * 2000 FROM people "
+        "ORDER BY id");
+    auto narrow_reader = narrow.execute_arrow(100);
+    REQUIRE(narrow_reader.types() ==
+            vector<ArrowType>{ArrowType::Int8, ArrowType::Int16,
+                              ArrowType::UInt8, ArrowType::UInt16});
+    narrow_reader.get_schema(&schema);
+    REQUIRE(string(schema.children[0]->format) == "c");
+    REQUIRE(string(schema.children[1]->format) == "s");
+    REQUIRE(string(schema.children[2]->format) == "C");
+    REQUIRE(string(schema.children[3]->format) == "S");
+    schema.release(&schema);
+
+    REQUIRE(narrow_reader.next(&batch));
+    REQUIRE(batch.length == 5);
+    REQUIRE(static_cast<const int8_t*>(batch.children[0]->buffers[1])[3] ==
+            -25);
+    REQUIRE(static_cast<const int16_t*>(batch.children[1]->buffers[1])[3] ==
+            -25000);
+    REQUIRE(static_cast<const uint8_t*>(batch.children[2]->buffers[1])[3] ==
+            250);
+    REQUIRE(static_cast<const uint16_t*>(batch.children[3]->buffers[1])[3] ==
+            50000);
+    REQUIRE(batch.children[3]->null_count == 1);
+    batch.release(&batch);
+
+    // NUMERIC columns follow their first value; REAL ones stay Double
+    db.execute("CREATE TABLE amounts (whole NUMERIC, part DECIMAL, x REAL)");
+    db.execute("INSERT INTO amounts VALUES (9007199254740993, 1.5, 2)");
+    auto amounts = db.prepare("SELECT whole, part, x FROM amounts");
+    auto amounts_reader = amounts.execute_arrow(0);
+    REQUIRE(amounts_reader.types() ==
+            vector<ArrowType>{ArrowType::Int64, ArrowType::Double,
+                              ArrowType::Double});
+    REQUIRE(amounts_reader.next(&batch));
+    REQUIRE(batch.length == 1);
+    REQUIRE(static_cast<const int64_t*>(batch.children[0]->buffers[1])[0] ==
+            9007199254740993);
+    batch.release(&batch);
+    REQUIRE(!amounts_reader.next(&batch));
+    db.execute("DROP TABLE amounts");
+  }
+
+  SECTION("Aggregate") {
+    auto rows = db.execute<Person>("SELECT name, age, data FROM people");
+    REQUIRE(rows.size() == 4);
+    REQUIRE(rows[1].name == "paul");
+    REQUIRE(rows[1].age == 20);
+    REQUIRE(rows[1].data == vector<char>{'E', 'B', 'G', 'H'});
+
+    auto stmt = db.prepare<Person>(
+        "SELECT name, age, data FROM people WHERE age > ? ORDER BY age");
+    for (const auto& person : stmt.execute_cursor(15)) {
+      REQUIRE(person.name == "paul");
+      REQUIRE(person.age == 20);
+      break;
+    }
+    REQUIRE(stmt.execute_value(20).name == "luke");
+
+    auto insert =
+        db.prepare("INSERT INTO people (name, age, data) VALUES (?, ?, ?)");
+    insert.execute(Person{"george", 30, {'Q'}});
+    insert.execute_many(vector<Person>{{"ringo", 35, {}}, {"yoko", 40, {}}});
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM people") == 7);
+
+    auto george = db.execute_value<Person>(
+        "SELECT name, age, data FROM people WHERE name=?", "george");
+    REQUIRE(george.age == 30);
+    REQUIRE(george.data == vector<char>{'Q'});
+
+    // The bindings of a temporary's fields are cleared when the call returns
+    struct Row {
+      string text;
+      int number;
+    };
+    auto length = db.prepare<int>("SELECT length(?) + ifnull(?, 0)");
+    REQUIRE(length.execute_value(Row{string(100, 'y'), 1}) == 101);
+    REQUIRE(length.execute_value() == 0);
+  }
+
+  SECTION("NativeTypes") {
+    db.execute(R"(
+      CREATE TABLE IF NOT EXISTS native (
+        id INTEGER PRIMARY KEY, count INTEGER, flag INTEGER, ratio REAL,
+        note TEXT
+      )
+    )");
+
+    int64_t snowflake = 1234567890123456789;
+    uint32_t count = 4000000000u;
+    auto insert = db.prepare(
+        "INSERT INTO native (id, count, flag, ratio, note) VALUES (?, ?, ?, ?, "
+        "?)");
+    insert.execute(snowflake, count, true, 0.5f, optional<string>("hello"));
+    insert.execute(int64_t(2), uint32_t(0), false, 1.5f,
+                   optional<string>());
+    insert.execute(int64_t(3), nullptr, nullopt, nullptr, nullptr);
+
+    REQUIRE(db.execute_value<int64_t>("SELECT id FROM native WHERE flag=?",
+                                      true) == snowflake);
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM native WHERE id=?",
+                                  snowflake) == 1);
+
+    auto rows = db.execute<int64_t, uint32_t, bool, float>(
+        "SELECT id, count, flag, ratio FROM native WHERE id=?", snowflake);
+    REQUIRE(rows.size() == 1);
+    auto [id, c, flag, ratio] = rows[0];
+    REQUIRE(id == snowflake);
+    REQUIRE(c == count);
+    REQUIRE(flag);
+    REQUIRE(ratio == 0.5f);
+
+    auto notes = db.execute<optional<string>>(
+        "SELECT note FROM native ORDER BY id");
+    REQUIRE(notes.size() == 3);
+    REQUIRE(!notes[0]);
+    REQUIRE(!notes[1]);
+    REQUIRE(*notes[2] == "hello");
+
+    auto counts = db.execute<optional<int64_t>>(
+        "SELECT count FROM native ORDER BY id");
+    REQUIRE(*counts[0] == 0);
+    REQUIRE(!counts[1]);
+    REQUIRE(*counts[2] == count);
+
+    // The binding of a temporary is cleared when the call returns
+    auto length = db.prepare<int>("SELECT length(?)");
+    REQUIRE(length.execute_value(optional<string>(string(100, 'x'))) == 100);
+    REQUIRE(length.execute_value() == 0);
+
+    db.execute("DROP TABLE IF EXISTS native");
+  }
+
+  SECTION("TypeTraits") {
+    db.execute("CREATE TABLE IF NOT EXISTS ids (id BLOB, name TEXT)");
+
+    Uuid id{};
+    for (auto i = 0; i < 16; i++) {
+      id.bytes[i] = static_cast<unsigned char>(i * 16);
+    }
+    db.execute("INSERT INTO ids (id, name) VALUES (?, ?)", id, "john");
+    REQUIRE(db.execute_value<int>("SELECT length(id) FROM ids") == 16);
+
+    auto val = db.execute_value<Uuid>("SELECT id FROM ids WHERE name=?",
+                                      "john");
+    REQUIRE(memcmp(val.bytes, id.bytes, 16) == 0);
+
+    auto rows = db.execute<Uuid, string>("SELECT id, name FROM ids");
+    REQUIRE(rows.size() == 1);
+    REQUIRE(get<0>(rows[0]).bytes[15] == 240);
+
+    REQUIRE(db.execute_value<string>("SELECT name FROM ids WHERE id=?", id) ==
+            "john");
+
+    // The binding of a temporary is cleared when the call returns
+    auto length = db.prepare<int>("SELECT length(?)");
+    REQUIRE(length.execute_value(Uuid{}) == 16);
+    REQUIRE(length.execute_value() == 0);
+
+    db.execute("DROP TABLE IF EXISTS ids");
+  }
+
+  SECTION("PrefetchCursor") {
+    auto stmt = db.prepare<string, int>("SELECT name, age FROM people");
+
+    for (auto depth : {1, 2, 16}) {
+      auto itData = data.begin();
+      for (const auto& [name, age] : stmt.execute_prefetch(depth)) {
+        REQUIRE(itData->first == name);
+        REQUIRE(itData->second == age);
+        ++itData;
+      }
+      REQUIRE(itData == data.end());
+    }
+
+    // Stopping early cancels the producer
+    {
+      auto cursor = db.execute_prefetch<string>("SELECT name FROM people", 1);
+      auto it = cursor.begin();
+      REQUIRE(*it == "john");
+    }
+
+    // even in the middle of a step that would never return
+    {
+      auto cursor = db.execute_prefetch<int>(
+          "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+          "SELECT COUNT(*) FROM c",
+          1);
+    }
+    REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM people") == 4);
+
+    // Errors of the producer reach the consumer
+    {
+      auto values = vector<int>();
+      auto cursor = db.execute_prefetch<Positive>(
+          "SELECT column1 FROM (VALUES (1), (2), (-1), (3))", 4);
+      REQUIRE_THROWS_AS(
+          [&] {
+            for (const auto& val : cursor) {
+              values.push_back(val.value);
+            }
+          }(),
+          out_of_range);
+      REQUIRE(values == vector<int>{1, 2});
+    }
+
+    vector<tuple<int>> rows;
+    for (auto i = 0; i < 10000; i++) {
+      rows.emplace_back(i);
+    }
+    db.execute("CREATE TABLE IF NOT EXISTS numbers (n INTEGER)");
+    db.prepare("INSERT INTO numbers (n) VALUES (?)").execute_many(rows);
+
+    long long sum = 0;
+    for (auto n : db.execute_prefetch<int>("SELECT n FROM numbers", 64)) {
+      sum += n;
+    }
+    REQUIRE(sum == 49995000);
+
+    db.execute("DROP TABLE IF EXISTS numbers");
+  }
+
+  SECTION("ParallelScan") {
+    auto query = "SELECT name, age FROM people WHERE rowid BETWEEN ? AND ?";
+
+    auto rows = db.parallel_execute<string, int>("people", query, 3);
+    REQUIRE(rows.size() == data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+      REQUIRE(get<0>(rows[i]) == data[i].first);
+      REQUIRE(get<1>(rows[i]) == data[i].second);
+    }
+
+    auto total = db.parallel_reduce<int>(
+        "people", "SELECT age FROM people WHERE id BETWEEN ? AND ?", 0,
+        [](int acc, int age) { return acc + age; },
+        [](int acc, int partial) { return acc + partial; }, 16, "id");
+    REQUIRE(total == 70);
+
+    // `init` is applied once, not once per partition
+    total = db.parallel_reduce<int>(
+        "people", "SELECT age FROM people WHERE id BETWEEN ? AND ?", 100,
+        [](int acc, int age) { return acc + age; },
+        [](int acc, int partial) { return acc + partial; }, 3, "id");
+    REQUIRE(total == 170);
+
+    vector<tuple<int>> numbers;
+    for (auto i = 0; i < 10000; i++) {
+      numbers.emplace_back(i);
+    }
+    db.execute("CREATE TABLE IF NOT EXISTS numbers (n INTEGER)");
+    db.prepare("INSERT INTO numbers (n) VALUES (?)").execute_many(numbers);
+
+    atomic<long long> sum(0);
+    db.parallel_scan<int>(
+        "numbers", "SELECT n FROM numbers WHERE rowid BETWEEN ? AND ?",
+        [&](int n) { sum += n; }, 7);
+    REQUIRE(sum == 49995000);
+
+    db.execute("DELETE FROM numbers");
+    auto empty = db.parallel_execute<int>(
+        "numbers", "SELECT n FROM numbers WHERE rowid BETWEEN ? AND ?");
+    REQUIRE(empty.empty());
+    db.execute("DROP TABLE IF EXISTS numbers");
+
+    REQUIRE_THROWS(db.parallel_execute<int>(
+        "people", "SELECT bad_column FROM people WHERE rowid BETWEEN ? AND ?"));
+
+    auto ranges = split_key_range(INT64_MIN, INT64_MAX, 3);
+    REQUIRE(ranges.size() == 3);
+    REQUIRE(ranges.front().first == INT64_MIN);
+    REQUIRE(ranges.back().last == INT64_MAX);
+    REQUIRE(ranges[0].last + 1 == ranges[1].first);
+    REQUIRE(split_key_range(5, 6, 4).size() == 2);
+
+    Sqlite memory(":memory:");
+    memory.execute("CREATE TABLE t (n INTEGER)");
+    memory.execute("INSERT INTO t VALUES (1)");
+    REQUIRE_THROWS_AS(memory.parallel_execute<int>(
+                          "t", "SELECT n FROM t WHERE rowid BETWEEN ? AND ?"),
+                      invalid_argument);
+  }
+
+  SECTION("ConnectionPool") {
+    {
+      ConnectionPoolConfig config;
+      config.readers = 2;
+      config.pragmas = {"PRAGMA cache_size = 1000"};
+      config.reader_statements = {"SELECT COUNT(*) FROM items"};
+      config.writer_statements = {"INSERT INTO items (n) VALUES (?)"};
+      {
+        Sqlite setup("./pool.db");
+        setup.execute("CREATE TABLE IF NOT EXISTS items (n INTEGER)");
+      }
+      ConnectionPool pool("./pool.db", config);
+      REQUIRE(pool.readers() == 2);
+
+      auto count = "SELECT COUNT(*) FROM items";
+      auto insert = "INSERT INTO items (n) VALUES (?)";
+
+      {
+        auto writer = pool.writer();
+        writer->execute(insert, 1);
+        REQUIRE(writer->statement_cache_stats().hits == 1);
+      }
+
+      // Readers keep going while the writer holds an open transaction
+      {
+        auto writer = pool.writer();
+        writer->execute("BEGIN");
+        writer->execute(insert, 2);
+        REQUIRE(pool.stats().writer_in_use);
+
+        vector<thread> threads;
+        atomic<int> reads(0);
+        for (auto i = 0; i < 4; i++) {
+          threads.emplace_back([&] {
+            auto reader = pool.reader();
+            if (reader->execute_value<int>(count) == 1) {
+              reads++;
+            }
+          });
+        }
+        for (auto& t : threads) {
+          t.join();
+        }
+        REQUIRE(reads == 4);
+        writer->execute("COMMIT");
+      }
+
+      {
+        auto reader = pool.reader();
+        REQUIRE(reader->execute_value<int>(count) == 2);
+        REQUIRE(reader->statement_cache_stats().hits >= 1);
+        REQUIRE_THROWS(reader->execute(insert, 3));
+
+        auto moved = std::move(reader);
+        auto other = pool.reader();
+        REQUIRE(pool.stats().readers_in_use == 2);
+
+        auto waits = pool.stats().reader_waits;
+        thread waiter([&] { pool.reader(); });
+        while (pool.stats().reader_waits == waits) {
+          this_thread::yield();
+        }
+        { auto released = std::move(other); }
+        waiter.join();
+      }
+
+      auto stats = pool.stats();
+      REQUIRE(stats.readers_in_use == 0);
+      REQUIRE(!stats.writer_in_use);
+      REQUIRE(stats.reader_acquisitions == 7);
+      REQUIRE(stats.writer_acquisitions == 2);
+      REQUIRE(stats.reader_waits >= 1);
+      REQUIRE(stats.reader_utilization() >= 0);
+      REQUIRE(stats.reader_utilization() <= 1);
+      REQUIRE(stats.writer_utilization() <= 1);
+    }
+    remove("./pool.db");
+    remove("./pool.db-wal");
+    remove("./pool.db-shm");
+
+    REQUIRE_THROWS_AS(ConnectionPool(":memory:"), invalid_argument);
+  }
+
+  SECTION("GroupCommitWriter") {
+    {
+      Sqlite setup("./group.db");
+      setup.execute("CREATE TABLE IF NOT EXISTS items (n INTEGER)");
+      setup.execute("DELETE FROM items");
+      setup.execute("CREATE TABLE IF NOT EXISTS keys (n INTEGER PRIMARY KEY)");
+      setup.execute("DELETE FROM keys");
+    }
+
+    {
+      GroupCommitWriter writer(Sqlite("./group.db"));
+
+      // Requests queued while a batch runs join that batch
+      promise<void> unblock;
+      auto blocked = unblock.get_future().share();
+      auto first = writer.submit([blocked](Sqlite&) { blocked.wait(); });
+      vector<future<void>> writes;
+      for (auto i = 0; i < 10; i++) {
+        writes.push_back(writer.execute("INSERT INTO items VALUES (?)", i));
+      }
+      auto bad = writer.execute("INSERT INTO no_such_table VALUES (1)");
+      unblock.set_value();
+      first.get();
+      for (auto& write : writes) {
+        write.get();
+      }
+      REQUIRE_THROWS(bad.get());
+      REQUIRE(writer.stats().commits == 1);
+      REQUIRE(writer.stats().rows == 11);
+
+      // Requests from several threads queued behind a blocked batch are
+      // committed together
+      auto commits = writer.stats().commits;
+      promise<void> release;
+      auto released = release.get_future().share();
+      auto blocker = writer.submit([released](Sqlite&) { released.wait(); });
+      vector<vector<future<void>>> results(4);
+      vector<thread> producers;
+      for (auto t = 0; t < 4; t++) {
+        producers.emplace_back([&writer, &results, t] {
+          for (auto i = 0; i < 250; i++) {
+            string text = to_string(t * 1000 + i);
+            results[t].push_back(writer.execute(
+                "INSERT INTO items VALUES (?)", text.c_str()));
+          }
+        });
+      }
+      for (auto& producer : producers) {
+        producer.join();
+      }
+      release.set_value();
+      blocker.get();
+      for (auto& writes : results) {
+        for (auto& write : writes) {
+          write.get();
+        }
+      }
+      REQUIRE(writer.stats().rows == 1012);
+      REQUIRE(writer.stats().commits == commits + 1);
+
+      // A request that makes SQLite roll back the transaction fails the
+      // requests before it; the ones after it go into the next batch
+      {
+        auto before = writer.stats();
+        promise<void> go;
+        auto started = go.get_future().share();
+        auto held = writer.submit([started](Sqlite&) { started.wait(); });
+        auto kept = writer.execute("INSERT INTO keys VALUES (?)", 1);
+        auto lost = writer.execute("INSERT INTO keys VALUES (?)", 2);
+        auto rollback =
+            writer.execute("INSERT OR ROLLBACK INTO keys VALUES (1)");
+        auto next = writer.execute("INSERT INTO keys VALUES (?)", 3);
+        go.set_value();
+        REQUIRE_THROWS(held.get());
+        REQUIRE_THROWS(kept.get());
+        REQUIRE_THROWS(lost.get());
+        REQUIRE_THROWS(rollback.get());
+        next.get();
+        // The lost batch is counted too
+        REQUIRE(writer.stats().commits == before.commits + 2);
+        REQUIRE(writer.stats().rows == before.rows + 1);
+        REQUIRE(writer.stats().seconds > before.seconds);
+      }
+
+      writer.submit([](Sqlite& db) {
+        db.execute("INSERT INTO items VALUES (?)", -1);
+      });
+    }
+
+    {
+      Sqlite check("./group.db");
+      REQUIRE(check.execute_value<int>("SELECT COUNT(*) FROM items") == 1011);
+      REQUIRE(check.execute_value<int>(
+                  "SELECT COUNT(*) FROM items WHERE n = 3999") == 0);
+      REQUIRE(check.execute_value<int>(
+                  "SELECT COUNT(*) FROM items WHERE n = 3249") == 1);
+      REQUIRE(check.execute_value<int>("SELECT COUNT(*) FROM keys") == 1);
+      REQUIRE(check.execute_value<int>("SELECT n FROM keys") == 3);
+    }
+    remove("./group.db");
+  }
+
+  SECTION("ConnectionOptions") {
+    {
+      Sqlite tuned("./options.db", ConnectionOptions::read_mostly()
+                                       .page_size(8192)
+                                       .cache_size(-1024)
+                                       .busy_timeout(250));
+      REQUIRE(tuned.is_open());
+      REQUIRE(tuned.execute_value<string>("PRAGMA journal_mode") == "wal");
+      REQUIRE(tuned.execute_value<int>("PRAGMA synchronous") == 1);
+      REQUIRE(tuned.execute_value<int>("PRAGMA cache_size") == -1024);
+      REQUIRE(tuned.execute_value<int>("PRAGMA busy_timeout") == 250);
+      REQUIRE(tuned.execute_value<int>("PRAGMA temp_store") == 2);
+      tuned.execute("CREATE TABLE IF NOT EXISTS t (n INTEGER)");
+      REQUIRE(tuned.execute_value<int>("PRAGMA page_size") == 8192);
+    }
+
+    {
+      Sqlite bulk("./options.db", ConnectionOptions::bulk_load());
+      REQUIRE(bulk.execute_value<string>("PRAGMA locking_mode") ==
+              "exclusive");
+      REQUIRE(bulk.execute_value<int>("PRAGMA synchronous") == 0);
+    }
+
+    {
+      Sqlite reader("./options.db", ConnectionOptions().read_only());
+      REQUIRE(reader.is_open());
+      REQUIRE_THROWS(reader.execute("INSERT INTO t VALUES (1)"));
+    }
+
+    auto options = ConnectionOptions().uri().no_mutex();
+    REQUIRE((options.flags() & SQLITE_OPEN_URI));
+    REQUIRE((options.flags() & SQLITE_OPEN_NOMUTEX));
+    REQUIRE(!(options.full_mutex().flags() & SQLITE_OPEN_NOMUTEX));
+    Sqlite memory("file:options?mode=memory", options);
+    REQUIRE(memory.is_open());
+
+    REQUIRE(!Sqlite("./no_such_dir/x.db", ConnectionOptions().read_only())
+                 .is_open());
+    REQUIRE(!Sqlite("./options.db",
+                    ConnectionOptions().pragma("no_such", "(1"))
+                 .is_open());
+
+    remove("./options.db");
+    remove("./options.db-wal");
+    remove("./options.db-shm");
+  }
+
+  SECTION("BusyBackoff") {
+    Sqlite holder("./busy.db");
+    holder.execute("CREATE TABLE IF NOT EXISTS t (n INTEGER)");
+
+    BusyBackoff backoff;
+    backoff.deadline = chrono::milliseconds(50);
+    Sqlite waiter("./busy.db", ConnectionOptions().busy_backoff(backoff));
+    REQUIRE(waiter.busy_stats().busy_events == 0);
+
+    holder.execute("BEGIN IMMEDIATE");
+    auto start = chrono::steady_clock::now();
+    REQUIRE_THROWS(waiter.execute("INSERT INTO t VALUES (1)"));
+    REQUIRE(chrono::steady_clock::now() - start >= chrono::milliseconds(50));
+
+    auto stats = waiter.busy_stats();
+    REQUIRE(stats.busy_events == 1);
+    REQUIRE(stats.give_ups == 1);
+    REQUIRE(stats.retries > 1);
+    REQUIRE(stats.wait_seconds > 0.03);
+
+    backoff.deadline = chrono::milliseconds(5000);
+    waiter.set_busy_backoff(backoff);
+    thread release([&] {
+      this_thread::sleep_for(chrono::milliseconds(20));
+      holder.execute("COMMIT");
+    });
+    waiter.execute("INSERT INTO t VALUES (1)");
+    release.join();
+
+    stats = waiter.busy_stats();
+    REQUIRE(stats.busy_events == 1);
+    REQUIRE(stats.give_ups == 0);
+    REQUIRE(waiter.execute_value<int>("SELECT COUNT(*) FROM t") == 1);
+
+    remove("./busy.db");
+  }
+
+  SECTION("TryExecute") {
+    db.execute("CREATE TABLE IF NOT EXISTS tags (name TEXT PRIMARY KEY)");
+    auto insert = db.prepare("INSERT INTO tags (name) VALUES (?)");
+
+    REQUIRE(insert.try_execute("red"));
+    auto duplicate = insert.try_execute("red");
+    REQUIRE(!duplicate);
+    REQUIRE(duplicate.error().code == SQLITE_CONSTRAINT);
+    REQUIRE(duplicate.error().extended_code == SQLITE_CONSTRAINT_PRIMARYKEY);
+    REQUIRE(string(duplicate.error().message()) ==
+            "UNIQUE constraint failed: tags.name");
+    REQUIRE_THROWS_AS(duplicate.value(), Exception);
+    REQUIRE(insert.try_execute("blue"));
+
+    auto flat = db.try_execute("INSERT INTO tags (name) VALUES (?)", "blue");
+    REQUIRE(flat.error().code == SQLITE_CONSTRAINT);
+
+    auto names = db.try_execute<string>("SELECT name FROM tags ORDER BY name");
+    REQUIRE(names);
+    REQUIRE(*names == vector<string>{"blue", "red"});
+
+    auto count = db.try_execute_value<int>("SELECT COUNT(*) FROM tags");
+    REQUIRE(count.value() == 2);
+    auto none =
+        db.try_execute_value<string>("SELECT name FROM tags WHERE 0");
+    REQUIRE(none.error().code == SQLITE_DONE);
+
+    // Prepare and bind failures are returned too
+    auto missing = db.try_execute("INSERT INTO missing VALUES (1)");
+    REQUIRE(missing.error().code == SQLITE_ERROR);
+    REQUIRE(string(missing.error().message()) == "no such table: missing");
+    auto extra = db.try_execute_value<int>("SELECT ?", 1, 2);
+    REQUIRE(extra.error().code == SQLITE_RANGE);
+    REQUIRE(!db.try_execute<int>("SELECT * FROM missing"));
+    REQUIRE(db.try_execute_value<int>("SELECT ?", 3).value() == 3);
+
+    auto stmt = db.prepare<string, int>(
+        "SELECT name, age FROM people WHERE age > ? ORDER BY age");
+    stmt.bind(15);
+    vector<string> found;
+    for (;;) {
+      auto row = stmt.try_step();
+      REQUIRE(row);
+      if (!*row) {
+        break;
+      }
+      found.push_back(get<0>(**row));
+    }
+    REQUIRE(found == vector<string>{"paul", "luke"});
+
+    try {
+      db.execute("INSERT INTO tags (name) VALUES ('red')");
+      FAIL();
+    } catch (const Exception& e) {
+      REQUIRE(e.code() == SQLITE_CONSTRAINT);
+      REQUIRE(e.extended_code() == SQLITE_CONSTRAINT_PRIMARYKEY);
+      REQUIRE(string(e.what()) == "UNIQUE constraint failed: tags.name");
+    }
+    try {
+      db.execute("INSERT INTO missing VALUES (1)");
+      FAIL();
+    } catch (const Exception& e) {
+      REQUIRE(e.code() == SQLITE_ERROR);
+      REQUIRE(string(e.what()) == "no such table: missing");
+    }
+    try {
+      db.execute_value<int>("SELECT ?", 1, 2);
+      FAIL();
+    } catch (const Exception& e) {
+      REQUIRE(e.code() == SQLITE_RANGE);
+    }
+
+    db.execute("DROP TABLE IF EXISTS tags");
+  }
+
+  SECTION("Transaction") {
+    auto count = "SELECT COUNT(*) FROM people";
+    auto insert = "INSERT INTO people (name, age) VALUES (?, ?)";
+
+    {
+      auto tx = db.transaction();
+      db.execute(insert, "jack", 30);
+      REQUIRE(tx.active());
+    }
+    REQUIRE(db.execute_value<int>(count) == 4);
+
+    try {
+      Transaction tx(db, TransactionMode::Immediate);
+      db.execute(insert, "jack", 30);
+      throw runtime_error("abort");
+    } catch (const runtime_error&) {
+    }
+    REQUIRE(db.execute_value<int>(count) == 4);
+
+    {
+      auto tx = db.transaction(TransactionMode::Exclusive);
+      db.execute(insert, "jack", 30);
+      {
+        auto outer = db.savepoint();
+        db.execute(insert, "jill", 31);
+        {
+          Savepoint inner(db);
+          db.execute(insert, "jane", 32);
+        }
+        REQUIRE(db.execute_value<int>(count) == 6);
+        outer.release();
+      }
+      {
+        auto discarded = db.savepoint();
+        db.execute(insert, "joan", 33);
+        discarded.rollback();
+        REQUIRE(!discarded.active());
+      }
+      tx.commit();
+      REQUIRE(!tx.active());
+    }
+    REQUIRE(db.execute_value<int>(count) == 6);
+
+    // Savepoints outside a transaction start one
+    {
+      auto savepoint = db.savepoint();
+      db.execute("DELETE FROM people WHERE age > 25");
+    }
+    REQUIRE(db.execute_value<int>(count) == 6);
+    {
+      auto savepoint = db.savepoint();
+      db.execute("DELETE FROM people WHERE age > 25");
+      savepoint.release();
+    }
+    REQUIRE(db.execute_value<int>(count) == 4);
+
+    // Rolling back the transaction discards the savepoints inside it
+    {
+      auto tx = db.transaction();
+      auto savepoint = db.savepoint();
+      db.execute(insert, "jack", 30);
+      tx.rollback();
+    }
+    REQUIRE(db.execute_value<int>(count) == 4);
+
+    {
+      auto tx = db.transaction();
+      REQUIRE_THROWS(db.transaction());
+    }
+
+    // Committing releases the savepoints still open inside the transaction
+    {
+      sqlite3* raw = nullptr;
+      sqlite3_open(":memory:", &raw);
+      {
+        TransactionControl control(raw);
+        Transaction tx(control);
+        Savepoint savepoint(control);
+        REQUIRE(control.depth() == 1);
+        tx.commit();
+        REQUIRE(control.depth() == 0);
+        REQUIRE(sqlite3_get_autocommit(raw));
+      }
+      sqlite3_close(raw);
+    }
+
+    // Nothing is rolled back when SQLite already did so
+    {
+      sqlite3* raw = nullptr;
+      sqlite3_open(":memory:", &raw);
+      sqlite3_exec(raw, "CREATE TABLE t (n INTEGER UNIQUE)", nullptr, nullptr,
+                   nullptr);
+      {
+        TransactionControl control(raw);
+        {
+          Transaction tx(control);
+          Savepoint savepoint(control);
+          sqlite3_exec(raw, "INSERT INTO t VALUES (1)", nullptr, nullptr,
+                       nullptr);
+          REQUIRE(sqlite3_exec(raw, "INSERT OR ROLLBACK INTO t VALUES (1)",
+                               nullptr, nullptr,
+                               nullptr) == SQLITE_CONSTRAINT);
+          REQUIRE(sqlite3_get_autocommit(raw));
+        }
+        REQUIRE(control.depth() == 0);
+        REQUIRE(sqlite3_extended_errcode(raw) == SQLITE_CONSTRAINT_UNIQUE);
+        Transaction tx(control);
+        tx.commit();
+      }
+      REQUIRE(sqlite3_close(raw) == SQLITE_OK);
+    }
+
+    // After such a rollback, savepoints fail instead of committing by
+    // themselves
+    {
+      db.execute("CREATE TABLE keys (n INTEGER PRIMARY KEY)");
+      auto tx = db.transaction();
+      {
+        auto savepoint = db.savepoint();
+        db.execute("INSERT INTO keys VALUES (1)");
+        REQUIRE_THROWS(db.execute("INSERT OR ROLLBACK INTO keys VALUES (1)"));
+      }
+      REQUIRE(tx.rolled_back());
+      try {
+        auto savepoint = db.savepoint();
+        FAIL("savepoint opened");
+      } catch (const Exception& e) {
+        REQUIRE(e.extended_code() == SQLITE_ABORT_ROLLBACK);
+      }
+      tx.rollback();
+      REQUIRE(!tx.active());
+      REQUIRE(db.execute_value<int>("SELECT COUNT(*) FROM keys") == 0);
+      db.execute("DROP TABLE keys");
+    }
+  }
+
+  SECTION("CursorLifetime") {
+    REQUIRE(db.busy_statements().empty());
+
+    auto query = "SELECT name FROM people";
+    {
+      auto cursor = db.execute_cursor<string>(query);
+      auto it = cursor.begin();
+      REQUIRE(*it == "john");
+      REQUIRE(db.busy_statements() == vector<string>{query});
+    }
+    REQUIRE(db.busy_statements().empty());
+
+    // Exhausting a cursor resets its statement right away
+    auto stmt = db.prepare<string>(query);
+    auto cursor = stmt.execute_cursor();
+    for (auto it = cursor.begin(); it != cursor.end(); ++it) {
+      REQUIRE(db.busy_statements().size() == 1);
+    }
+    REQUIRE(db.busy_statements().empty());
+
+    // A moved-from cursor leaves the statement to the new owner
+    auto first = stmt.execute_cursor();
+    REQUIRE(*first.begin() == "john");
+    auto second = std::move(first);
+    REQUIRE(db.busy_statements().size() == 1);
+
+    // and iterators taken before the move keep working after it
+    {
+      auto source =
+          make_unique<Cursor<string>>(db.execute_cursor<string>(query));
+      auto it = source->begin();
+      REQUIRE(*it == "john");
+      auto moved = std::move(*source);
+      source.reset();
+      vector<string> names;
+      for (; it != moved.end(); ++it) {
+        names.push_back(*it);
+      }
+      REQUIRE(names == vector<string>{"john", "paul", "mark", "luke"});
+    }
+
+    // The abandoned read no longer blocks a truncating checkpoint
+    {
+      Sqlite wal("./wal.db");
+      wal.execute_value<string>("PRAGMA journal_mode=WAL");
+      wal.execute("CREATE TABLE IF NOT EXISTS t (n INTEGER)");
+      wal.execute("INSERT INTO t VALUES (1)");
+      wal.execute("INSERT INTO t VALUES (2)");
+      Sqlite writer("./wal.db");
+      {
+        auto rows = wal.execute_cursor<int>("SELECT n FROM t");
+        REQUIRE(*rows.begin() == 1);
+        writer.execute("INSERT INTO t VALUES (3)");
+        REQUIRE(get<0>(writer.execute<int, int, int>(
+                    "PRAGMA wal_checkpoint(TRUNCATE)")[0]) == 1);
+      }
+      writer.execute("INSERT INTO t VALUES (4)");
+      REQUIRE(get<0>(writer.execute<int, int, int>(
+                  "PRAGMA wal_checkpoint(TRUNCATE)")[0]) == 0);
+    }
+    remove("./wal.db");
+    remove("./wal.db-wal");
+    remove("./wal.db-shm");
+  }
+
   SECTION("Count") {
     auto sql = "SELECT COUNT(*) FROM people";
     auto val = db.prepare<int>(sql).execute_value();
@@ -219,6 +1464,104 @@ TEST_CASE("Sqlite Test", "[general]") {
     }
   }
 
+  SECTION("FlatAPI - StatementCache") {
+    db.clear_statement_cache();
+    auto base = db.statement_cache_stats();
+
+    auto sql = "SELECT age FROM people WHERE name=?";
+    REQUIRE(db.execute_value<int>(sql, "john") == 10);
+    REQUIRE(db.execute_value<int>(sql, "paul") == 20);
+    REQUIRE(db.execute_value<int>(sql, "mark") == 15);
+    REQUIRE(db.statement_cache_size() == 1);
+    REQUIRE(db.statement_cache_stats().misses - base.misses == 1);
+    REQUIRE(db.statement_cache_stats().hits - base.hits == 2);
+
+    // A statement held by a live cursor is not handed out twice
+    {
+      auto cursor = db.execute_cursor<string>("SELECT name FROM people");
+      auto it = cursor.begin();
+      REQUIRE(db.execute<string>("SELECT name FROM people").size() == 4);
+      REQUIRE(*it == "john");
+    }
+
+    db.set_statement_cache_capacity(1);
+    REQUIRE(db.statement_cache_size() == 1);
+    db.execute_value<int>("SELECT COUNT(*) FROM people");
+    REQUIRE(db.statement_cache_stats().evictions - base.evictions >= 1);
+
+    // Clearing the cache keeps a pinned statement alive for its cursor
+    {
+      auto cursor = db.execute_cursor<string>("SELECT name FROM people");
+      auto it = cursor.begin();
+      db.clear_statement_cache();
+      REQUIRE(db.statement_cache_size() == 0);
+      REQUIRE(*it == "john");
+      ++it;
+      REQUIRE(*it == "paul");
+    }
+
+    db.set_statement_cache_capacity(0);
+    REQUIRE(db.statement_cache_size() == 0);
+    REQUIRE(db.execute_value<int>(sql, "luke") == 25);
+    REQUIRE(db.statement_cache_size() == 0);
+  }
+
+#if __cplusplus >= 202002L
+  SECTION("AsyncSqlite") {
+    AsyncSqlite async(Sqlite("./test.db"));
+
+    REQUIRE(sum_ages(async).get() == 70);
+    REQUIRE(query_fails(async).get());
+
+    fill_numbers(async, 1000).get();
+    REQUIRE(sum_numbers(async).get() == 499500);
+
+    // Frames are recycled once the first round warmed the allocator
+    auto allocations = FrameAllocator::heap_allocations();
+    for (auto i = 0; i < 3; i++) {
+      REQUIRE(sum_ages(async).get() == 70);
+    }
+    REQUIRE(FrameAllocator::heap_allocations() == allocations);
+  }
+
+  SECTION("StatementSlot") {
+    auto stmt = db.stmt<"SELECT age FROM people WHERE name=?", int>();
+    REQUIRE(stmt.execute_value("john") == 10);
+
+    // The same literal maps to the same slot
+    auto again = db.stmt<"SELECT age FROM people WHERE name=?", int>();
+    REQUIRE(again.execute_value("luke") == 25);
+    REQUIRE(StatementSlot<"SELECT age FROM people WHERE name=?">::index() ==
+            StatementSlot<"SELECT age FROM people WHERE name=?">::index());
+    REQUIRE(StatementSlot<"SELECT age FROM people WHERE name=?">::index() !=
+            StatementSlot<"SELECT name FROM people">::index());
+
+    // A slot used during static initialization keeps its own index
+    REQUIRE(early_slot == StatementSlot<"SELECT 'early'">::index());
+    REQUIRE(early_slot != StatementSlot<"SELECT name FROM people">::index());
+
+    auto rows =
+        db.stmt<"SELECT name, age FROM people", string, int>().execute();
+    REQUIRE(rows.size() == 4);
+    REQUIRE(get<0>(rows[1]) == "paul");
+
+    // A slot in use is not shared, so nested loops over one literal work
+    auto pairs = 0;
+    for (auto outer :
+         db.stmt<"SELECT age FROM people", int>().execute_cursor()) {
+      for (auto inner :
+           db.stmt<"SELECT age FROM people", int>().execute_cursor()) {
+        pairs += outer > 0 && inner > 0;
+      }
+    }
+    REQUIRE(pairs == 16);
+
+    db.stmt<"UPDATE people SET age=age+1 WHERE name=?">().execute("mark");
+    REQUIRE(db.execute_value<int>("SELECT age FROM people WHERE name='mark'") ==
+            16);
+  }
+#endif
+
   SECTION("Exceptions") {
     SECTION("verify") {
       db.execute("DROP TABLE IF EXISTS absent");
@@ -251,3 +1594,70 @@ TEST_CASE("Sqlite Test", "[general]") {
   db.prepare("DROP TABLE IF EXISTS people").execute();
 }
 
+TEST_CASE("Bulk insert benchmark", "[.][benchmark]") {
+  Sqlite db("./bench.db");
+  db.execute("DROP TABLE IF EXISTS bench");
+  db.execute("CREATE TABLE bench (name TEXT, value INTEGER)");
+
+  vector<tuple<string, int>> rows;
+  for (auto i = 0; i < 10000; i++) {
+    rows.emplace_back("name" + to_string(i), i);
+  }
+
+  auto insert = db.prepare("INSERT INTO bench (name, value) VALUES (?, ?)");
+
+  BENCHMARK("execute per row") {
+    db.execute("BEGIN");
+    for (const auto& [name, value] : rows) {
+      insert.execute(name, value);
+    }
+    db.execute("COMMIT");
+  };
+
+  BENCHMARK("execute_many") { return insert.execute_many(rows).rows; };
+
+  auto batch = db.prepare_insert("bench", {"name", "value"});
+  BENCHMARK("BatchInserter") { return batch.execute(rows).rows; };
+
+  BENCHMARK("prepare BEGIN/COMMIT") {
+    db.prepare("BEGIN").execute();
+    db.prepare("COMMIT").execute();
+  };
+
+  BENCHMARK("Transaction") { db.transaction().commit(); };
+
+  db.execute("DROP TABLE IF EXISTS bench");
+}
+
+TEST_CASE("Point lookup benchmark", "[.][benchmark]") {
+  Sqlite db("./bench.db");
+  db.execute("DROP TABLE IF EXISTS bench");
+  db.execute("CREATE TABLE bench (id INTEGER PRIMARY KEY, value INTEGER)");
+  db.prepare("INSERT INTO bench (value) VALUES (?)")
+      .execute_many(vector<int>(1000, 42));
+
+  auto sql = "SELECT value FROM bench WHERE id=?";
+
+  sqlite3* raw_db = nullptr;
+  sqlite3_open("./bench.db", &raw_db);
+  sqlite3_stmt* raw = nullptr;
+  sqlite3_prepare_v2(raw_db, sql, -1, &raw, nullptr);
+  BENCHMARK("raw C API") {
+    sqlite3_bind_int(raw, 1, 500);
+    sqlite3_step(raw);
+    auto value = sqlite3_column_int(raw, 0);
+    sqlite3_reset(raw);
+    return value;
+  };
+  sqlite3_finalize(raw);
+  sqlite3_close(raw_db);
+
+  auto stmt = db.prepare<int>(sql);
+  BENCHMARK("Statement::execute_value") { return stmt.execute_value(500); };
+
+  BENCHMARK("Sqlite::execute_value") {
+    return db.execute_value<int>(sql, 500);
+  };
+
+  db.execute("DROP TABLE IF EXISTS bench");
+}